@@ -1,9 +1,13 @@
 #pragma once
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #ifdef _WIN32
@@ -74,6 +78,10 @@ enum ObjectType {
 	_OT_COUNT
 };
 
+/// Bitmask of object types, e.g. used by SceneLoader::setObjectFilter
+constexpr uint32_t objectTypeMask(ObjectType type) { return uint32_t(1) << uint32_t(type); }
+constexpr uint32_t OTM_ALL = (uint32_t(1) << uint32_t(_OT_COUNT)) - 1;
+
 enum PropertyType {
 	PT_NONE = 0,
 	PT_ANIMATION,
@@ -111,7 +119,9 @@ TPM_NODISCARD inline bool operator!=(const Vector& a, const Vector& b)
 using Point = Vector;
 
 // --------------- Transform
-/// The Transform structure is only for storage and internal calculations. Use a fully featured math library for your own calculations
+/// The Transform structure is only for storage and internal calculations. Use a fully featured math library for your own calculations.
+/// Composition uses SIMD kernels and skips the last row of affine transforms.
+/// Define TPM_EXACT_TRANSFORM when building the library to use the plain reference implementation instead
 struct TPM_LIB Transform {
 	using Array = std::array<Number, 4 * 4>;
 	Array matrix; // Row major
@@ -130,6 +140,16 @@ struct TPM_LIB Transform {
 	inline Number& operator()(int i, int j) { return matrix[i * 4 + j]; }
 	inline Number operator()(int i, int j) const { return matrix[i * 4 + j]; }
 
+	/// Returns the identity if the transform is not invertible
+	TPM_NODISCARD Transform inverse(bool* ok = nullptr) const;
+	TPM_NODISCARD Transform transposed() const;
+
+	/// True if the last row is (0, 0, 0, 1)
+	TPM_NODISCARD inline bool isAffine() const
+	{
+		return matrix[12] == Number(0) && matrix[13] == Number(0) && matrix[14] == Number(0) && matrix[15] == Number(1);
+	}
+
 	inline Transform operator*(const Transform& other) const
 	{
 		return multiplyFromRight(other);
@@ -141,6 +161,22 @@ struct TPM_LIB Transform {
 		return *this;
 	}
 
+	/// Batch application to packed x,y,z triplets (AoS) or to separate component arrays (SoA).
+	/// Input and output may be the same buffers. Points are divided by w if the transform is projective,
+	/// normals are transformed with the inverse transpose and normalized afterwards
+	void transformPoints(const float* in, float* out, size_t count) const;
+	void transformPoints(const double* in, double* out, size_t count) const;
+	void transformPoints(const float* inX, const float* inY, const float* inZ, float* outX, float* outY, float* outZ, size_t count) const;
+	void transformPoints(const double* inX, const double* inY, const double* inZ, double* outX, double* outY, double* outZ, size_t count) const;
+	void transformVectors(const float* in, float* out, size_t count) const;
+	void transformVectors(const double* in, double* out, size_t count) const;
+	void transformVectors(const float* inX, const float* inY, const float* inZ, float* outX, float* outY, float* outZ, size_t count) const;
+	void transformVectors(const double* inX, const double* inY, const double* inZ, double* outX, double* outY, double* outZ, size_t count) const;
+	void transformNormals(const float* in, float* out, size_t count) const;
+	void transformNormals(const double* in, double* out, size_t count) const;
+	void transformNormals(const float* inX, const float* inY, const float* inZ, float* outX, float* outY, float* outZ, size_t count) const;
+	void transformNormals(const double* inX, const double* inY, const double* inZ, double* outX, double* outY, double* outZ, size_t count) const;
+
 	static Transform fromIdentity();
 	static Transform fromTranslation(const Vector& delta);
 	static Transform fromScale(const Vector& scale);
@@ -163,6 +199,88 @@ TPM_NODISCARD inline bool operator!=(const Transform& a, const Transform& b)
 	return !(a == b);
 }
 
+// --------------- Quaternion
+/// Unit quaternion representing a rotation. Only for storage and interpolation
+struct TPM_LIB Quaternion {
+	Number w, x, y, z;
+	Quaternion() = default;
+	inline Quaternion(Number w, Number x, Number y, Number z)
+		: w(w)
+		, x(x)
+		, y(y)
+		, z(z)
+	{
+	}
+
+	inline Quaternion operator*(const Quaternion& o) const
+	{
+		return Quaternion(w * o.w - x * o.x - y * o.y - z * o.z,
+						  w * o.x + x * o.w + y * o.z - z * o.y,
+						  w * o.y - x * o.z + y * o.w + z * o.x,
+						  w * o.z + x * o.y - y * o.x + z * o.w);
+	}
+
+	TPM_NODISCARD Vector rotate(const Vector& v) const;
+	TPM_NODISCARD Transform toTransform() const;
+
+	static inline Quaternion fromIdentity() { return Quaternion(1, 0, 0, 0); }
+	static Quaternion fromRotation(const Vector& axis, Number angle_degree);
+	/// Upper 3x3 block has to be a proper rotation matrix
+	static Quaternion fromMatrix(const Transform& transform);
+	/// Spherical interpolation along the shortest path
+	static Quaternion slerp(const Quaternion& a, const Quaternion& b, Number t);
+};
+TPM_NODISCARD inline bool operator==(const Quaternion& a, const Quaternion& b)
+{
+	return a.w == b.w && a.x == b.x && a.y == b.y && a.z == b.z;
+}
+TPM_NODISCARD inline bool operator!=(const Quaternion& a, const Quaternion& b)
+{
+	return !(a == b);
+}
+
+// --------------- TRS
+/// Affine transform decomposed into Translation * Rotation * Scale
+struct TPM_LIB TransformTRS {
+	Vector translation = Vector(0, 0, 0);
+	Quaternion rotation = Quaternion::fromIdentity();
+	Vector scale		= Vector(1, 1, 1);
+
+	TPM_NODISCARD Transform toTransform() const;
+
+	/// Numeric polar decomposition. Shear and projective parts of the transform are lost
+	static TransformTRS fromTransform(const Transform& transform);
+
+	/// Linear interpolation of translation and scale, spherical interpolation of the rotation
+	static TransformTRS interpolate(const TransformTRS& a, const TransformTRS& b, Number t);
+};
+
+enum TransformOpType {
+	TOT_TRANSLATE = 0,
+	TOT_SCALE,
+	TOT_ROTATE,
+	TOT_LOOKAT,
+	TOT_MATRIX
+};
+
+/// Single operation of a transform chain as given in the scene file
+struct TPM_LIB TransformOp {
+	TransformOpType type = TOT_MATRIX;
+	Vector value		 = Vector(0, 0, 0); // Delta (translate), factors (scale), axis (rotate) or origin (lookAt)
+	Vector target		 = Vector(0, 0, 0); // LookAt only
+	Vector up			 = Vector(0, 0, 0); // LookAt only
+	Number angle		 = Number(0);		 // Degrees, rotate only
+	Transform matrix	 = Transform::fromIdentity();
+};
+
+/// Operations of a transform chain in document order. If the chain only contains translations, rotations,
+/// look-ats and scales which do not introduce shear, the canonical TRS decomposition is available as well
+struct TPM_LIB TransformDecomposition {
+	std::vector<TransformOp> operations;
+	bool isTRS = true;
+	TransformTRS trs;
+};
+
 // --------------- Animation
 /// A list of time and transform pairs. It is not sorted in any way
 struct TPM_LIB Animation {
@@ -183,6 +301,45 @@ private:
 	std::vector<Number> mTimes;
 	std::vector<Transform> mTransforms;
 };
+TPM_NODISCARD inline bool operator==(const Animation& a, const Animation& b)
+{
+	return a.keyFrameTimes() == b.keyFrameTimes() && a.keyFrameTransforms() == b.keyFrameTransforms();
+}
+TPM_NODISCARD inline bool operator!=(const Animation& a, const Animation& b)
+{
+	return !(a == b);
+}
+
+/// Finalized animation with keyframes sorted by time and decomposed into TRS form.
+/// Lookups use a uniform grid if the keyframes are evenly spaced and a binary search otherwise.
+/// Times outside the keyframe range are clamped
+class TPM_LIB AnimationEvaluator {
+public:
+	AnimationEvaluator() = default;
+	explicit AnimationEvaluator(const Animation& animation);
+
+	inline size_t keyFrameCount() const { return mTimes.size(); }
+	inline const std::vector<Number>& keyFrameTimes() const { return mTimes; }
+	inline const std::vector<TransformTRS>& keyFrames() const { return mKeyFrames; }
+	inline bool isUniform() const { return mUniform; }
+
+	/// Returns the identity if no keyframes are available
+	TPM_NODISCARD TransformTRS evaluateTRS(Number time) const;
+	TPM_NODISCARD inline Transform evaluate(Number time) const { return evaluateTRS(time).toTransform(); }
+
+	/// Fill the preallocated buffer with count evaluations. Ascending times are evaluated faster
+	void evaluate(const Number* times, size_t count, TransformTRS* out) const;
+	void evaluate(const Number* times, size_t count, Transform* out) const;
+
+private:
+	size_t findSegment(Number time, size_t hint) const;
+	TransformTRS interpolate(size_t segment, Number time) const;
+
+	std::vector<Number> mTimes;
+	std::vector<TransformTRS> mKeyFrames;
+	bool mUniform	= false;
+	Number mInvStep = Number(0);
+};
 
 // --------------- Color
 struct TPM_LIB Color {
@@ -212,22 +369,43 @@ public:
 		mWeights.push_back(uniform);
 	}
 
-	inline Spectrum(const std::vector<int>& wavelengths, const std::vector<Number>& weights)
+	inline Spectrum(const std::vector<Number>& wavelengths, const std::vector<Number>& weights)
 		: mWavelengths(wavelengths)
 		, mWeights(weights)
 	{
 	}
 
+	inline Spectrum(std::vector<Number>&& wavelengths, std::vector<Number>&& weights)
+		: mWavelengths(std::move(wavelengths))
+		, mWeights(std::move(weights))
+	{
+	}
+
 	TPM_NODISCARD inline bool isUniform() const { return mWavelengths.size() == 0 && mWeights.size() == 1; }
 	TPM_NODISCARD inline Number uniformValue() const { return mWeights.front(); }
 
-	TPM_NODISCARD inline const std::vector<int>& wavelengths() const { return mWavelengths; }
+	/// Wavelengths in nanometers, not necessarily integral
+	TPM_NODISCARD inline const std::vector<Number>& wavelengths() const { return mWavelengths; }
 	TPM_NODISCARD inline const std::vector<Number>& weights() const { return mWeights; }
 
+	/// Linear interpolation between the samples, zero outside of the measured range.
+	/// Wavelengths are expected in ascending order
+	TPM_NODISCARD Number evaluate(Number wavelength) const;
+	/// Same as above for multiple wavelengths, fastest if the given wavelengths are in ascending order as well
+	void evaluate(const Number* wavelengths, Number* out, size_t count) const;
+
 private:
-	std::vector<int> mWavelengths;
+	std::vector<Number> mWavelengths;
 	std::vector<Number> mWeights;
 };
+TPM_NODISCARD inline bool operator==(const Spectrum& a, const Spectrum& b)
+{
+	return a.wavelengths() == b.wavelengths() && a.weights() == b.weights();
+}
+TPM_NODISCARD inline bool operator!=(const Spectrum& a, const Spectrum& b)
+{
+	return !(a == b);
+}
 
 // --------------- Blackbody
 struct TPM_LIB Blackbody {
@@ -248,7 +426,20 @@ TPM_NODISCARD inline bool operator!=(const Blackbody& a, const Blackbody& b)
 }
 
 // --------------- Property
+/// Precomputed matrices of a transform property
+struct TPM_LIB TransformCache {
+	Transform inverse;
+	Transform normal; // Inverse transpose
+};
+
+/// Raw element of a property not decoded yet, see SceneLoader::enableLazyProperties
+struct LazyProperty;
+class ValuePool;
+class ChangeJournal;
+
 class TPM_LIB Property {
+	friend class ValuePool;
+
 public:
 	inline Property()
 		: mType(PT_NONE)
@@ -266,6 +457,8 @@ public:
 
 	inline Number getNumber(Number def = Number(0), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getNumber(def, ok);
 		if (mType == PT_NUMBER) {
 			if (ok)
 				*ok = true;
@@ -285,6 +478,8 @@ public:
 
 	inline Integer getInteger(Integer def = Integer(0), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getInteger(def, ok);
 		if (mType == PT_INTEGER) {
 			if (ok)
 				*ok = true;
@@ -304,6 +499,8 @@ public:
 
 	inline bool getBool(bool def = false, bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getBool(def, ok);
 		if (mType == PT_BOOL) {
 			if (ok)
 				*ok = true;
@@ -323,6 +520,8 @@ public:
 
 	inline const Vector& getVector(const Vector& def = Vector(0, 0, 0), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getVector(def, ok);
 		if (mType == PT_VECTOR) {
 			if (ok)
 				*ok = true;
@@ -342,6 +541,8 @@ public:
 
 	inline const Transform& getTransform(const Transform& def = Transform::fromIdentity(), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getTransform(def, ok);
 		if (mType == PT_TRANSFORM) {
 			if (ok)
 				*ok = true;
@@ -358,9 +559,30 @@ public:
 		p.mTransform = v;
 		return p;
 	}
+	/// Construct with cached inverse and normal matrix
+	TPM_NODISCARD static Property fromTransform(const Transform& v, const Transform& inverse);
+
+	/// Inverse of the transform property. Only computed if not cached already
+	TPM_NODISCARD Transform getTransformInverse(const Transform& def = Transform::fromIdentity(), bool* ok = nullptr) const;
+	/// Inverse transpose of the transform property, used for normals. Only computed if not cached already
+	TPM_NODISCARD Transform getTransformNormal(const Transform& def = Transform::fromIdentity(), bool* ok = nullptr) const;
+	TPM_NODISCARD inline bool hasCachedTransformInverse() const { return mLazy ? decoded().hasCachedTransformInverse() : mTransformCache != nullptr; }
+
+	/// Construct with the operations the transform was built from
+	TPM_NODISCARD static Property fromTransform(const Transform& v, const std::shared_ptr<const TransformDecomposition>& decomposition);
+	TPM_NODISCARD static Property fromTransform(const Transform& v, const Transform& inverse, const std::shared_ptr<const TransformDecomposition>& decomposition);
+	/// Null if the transform property was not loaded with decompositions enabled
+	TPM_NODISCARD inline const TransformDecomposition* getTransformDecomposition() const
+	{
+		if (mLazy)
+			return decoded().getTransformDecomposition();
+		return mType == PT_TRANSFORM ? mTransformDecomposition.get() : nullptr;
+	}
 
 	inline const Color& getColor(const Color& def = Color(0, 0, 0), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getColor(def, ok);
 		if (mType == PT_COLOR) {
 			if (ok)
 				*ok = true;
@@ -380,6 +602,8 @@ public:
 
 	inline const std::string& getString(const std::string& def = "", bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getString(def, ok);
 		if (mType == PT_STRING) {
 			if (ok)
 				*ok = true;
@@ -399,10 +623,12 @@ public:
 
 	inline const Spectrum& getSpectrum(const Spectrum& def = Spectrum(), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getSpectrum(def, ok);
 		if (mType == PT_SPECTRUM) {
 			if (ok)
 				*ok = true;
-			return mSpectrum;
+			return *mSpectrum;
 		} else {
 			if (ok)
 				*ok = false;
@@ -412,12 +638,20 @@ public:
 	TPM_NODISCARD static inline Property fromSpectrum(const Spectrum& spec)
 	{
 		Property p(PT_SPECTRUM);
-		p.mSpectrum = spec;
+		p.mSpectrum = std::make_shared<const Spectrum>(spec);
+		return p;
+	}
+	TPM_NODISCARD static inline Property fromSpectrum(Spectrum&& spec)
+	{
+		Property p(PT_SPECTRUM);
+		p.mSpectrum = std::make_shared<const Spectrum>(std::move(spec));
 		return p;
 	}
 
 	inline Blackbody getBlackbody(const Blackbody& def = Blackbody(6504, 1), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getBlackbody(def, ok);
 		if (mType == PT_BLACKBODY) {
 			if (ok)
 				*ok = true;
@@ -437,6 +671,8 @@ public:
 
 	inline const Animation& getAnimation(const Animation& def = Animation(), bool* ok = nullptr) const
 	{
+		if (mLazy)
+			return decoded().getAnimation(def, ok);
 		if (mType == PT_ANIMATION) {
 			if (ok)
 				*ok = true;
@@ -454,12 +690,21 @@ public:
 		return p;
 	}
 
+	/// Property of the given type decoded from the raw element on first access.
+	/// Decoding is thread-safe and done only once, even for copies of the property.
+	/// If the element turns out to be invalid (including errors like missing files), all getters return the default value and never throw
+	TPM_NODISCARD static Property fromLazy(PropertyType type, const std::shared_ptr<LazyProperty>& lazy);
+	/// False if the property is lazy and no getter was called yet
+	TPM_NODISCARD bool isDecoded() const;
+
 private:
 	inline explicit Property(PropertyType type)
 		: mType(type)
 	{
 	}
 
+	const Property& decoded() const;
+
 	PropertyType mType;
 
 	// Data Types
@@ -474,12 +719,100 @@ private:
 		Blackbody mBlackbody;
 	};
 	std::string mString;
-	Spectrum mSpectrum;
+	std::shared_ptr<const Spectrum> mSpectrum; // Might be shared with other properties, see Scene::poolValues
 	Animation mAnimation;
+	std::shared_ptr<const TransformCache> mTransformCache;
+	std::shared_ptr<const TransformDecomposition> mTransformDecomposition;
+	std::shared_ptr<LazyProperty> mLazy;
+};
+TPM_NODISCARD inline bool operator==(const Property& a, const Property& b)
+{
+	if (a.type() != b.type())
+		return false;
+
+	switch (a.type()) {
+	case PT_ANIMATION:
+		return a.getAnimation() == b.getAnimation();
+	case PT_BLACKBODY:
+		return a.getBlackbody() == b.getBlackbody();
+	case PT_BOOL:
+		return a.getBool() == b.getBool();
+	case PT_INTEGER:
+		return a.getInteger() == b.getInteger();
+	case PT_NUMBER:
+		return a.getNumber() == b.getNumber();
+	case PT_COLOR:
+		return a.getColor() == b.getColor();
+	case PT_SPECTRUM:
+		return a.getSpectrum() == b.getSpectrum();
+	case PT_STRING:
+		return a.getString() == b.getString();
+	case PT_TRANSFORM:
+		return a.getTransform() == b.getTransform();
+	case PT_VECTOR:
+		return a.getVector() == b.getVector();
+	default:
+		return true;
+	}
+}
+TPM_NODISCARD inline bool operator!=(const Property& a, const Property& b)
+{
+	return !(a == b);
+}
+
+// --------------- Binding
+/// Field of a user struct filled directly by the loader, see SceneLoader::bindPlugin
+struct TPM_LIB FieldBinding {
+	const char* name; // Property name after the optional camel case conversion
+	PropertyType type;
+	size_t offset;
+};
+
+template <typename T>
+struct PropertyTypeOf;
+#define _TPM_PROPERTY_TYPE_OF(T, PT) \
+	template <> \
+	struct PropertyTypeOf<T> { \
+		static constexpr PropertyType value = PT; \
+	}
+_TPM_PROPERTY_TYPE_OF(Animation, PT_ANIMATION);
+_TPM_PROPERTY_TYPE_OF(Blackbody, PT_BLACKBODY);
+_TPM_PROPERTY_TYPE_OF(bool, PT_BOOL);
+_TPM_PROPERTY_TYPE_OF(Integer, PT_INTEGER);
+_TPM_PROPERTY_TYPE_OF(Number, PT_NUMBER);
+_TPM_PROPERTY_TYPE_OF(Color, PT_COLOR);
+_TPM_PROPERTY_TYPE_OF(Spectrum, PT_SPECTRUM);
+_TPM_PROPERTY_TYPE_OF(std::string, PT_STRING);
+_TPM_PROPERTY_TYPE_OF(Transform, PT_TRANSFORM);
+_TPM_PROPERTY_TYPE_OF(Vector, PT_VECTOR);
+#undef _TPM_PROPERTY_TYPE_OF
+
+/// Declare a field of a standard layout struct, e.g. TPM_BIND_FIELD(Sphere, "radius", radius). The property type is deduced from the member
+#define TPM_BIND_FIELD(Struct, name, member) \
+	TPM_NAMESPACE::FieldBinding { name, TPM_NAMESPACE::PropertyTypeOf<decltype(Struct::member)>::value, offsetof(Struct, member) }
+
+// Unique address per bound type
+template <typename T>
+struct BindingTag {
+	static const char id;
 };
+template <typename T>
+const char BindingTag<T>::id = 0;
 
 // --------------- Object
+class Object;
+struct ObjectVisit;
+
+/// Child of an object in document order. The name is empty for anonymous children
+struct TPM_LIB ObjectChild {
+	std::string name;
+	Object* object;
+};
+
 class TPM_LIB Object {
+	friend class InternalSceneLoader;
+	friend class Scene;
+
 public:
 	inline explicit Object(ObjectType type, const std::string& pluginType, const std::string& id)
 		: mType(type)
@@ -488,11 +821,13 @@ public:
 	{
 	}
 
-	Object(const Object& other) = default;
-	Object(Object&& other)		= default;
+	/// Copies share the children with the original, but do not record to its journal, see Scene::enableJournal
+	Object(const Object& other);
+	Object(Object&& other);
+	~Object();
 
-	Object& operator=(const Object& other) = default;
-	Object& operator=(Object&& other)	   = default;
+	Object& operator=(const Object& other);
+	Object& operator=(Object&& other);
 
 	TPM_NODISCARD inline ObjectType type() const { return mType; }
 	TPM_NODISCARD inline const std::string& pluginType() const { return mPluginType; }
@@ -506,32 +841,297 @@ public:
 		return mProperties.count(key) ? mProperties.at(key) : Property();
 	}
 
-	inline void setProperty(const std::string& key, const Property& prop) { mProperties[key] = prop; }
+	inline void setProperty(const std::string& key, const Property& prop)
+	{
+		if (mJournal)
+			recordProperty(key, prop.type());
+		mProperties[key] = prop;
+		invalidateHash(true);
+	}
 	TPM_NODISCARD inline const std::unordered_map<std::string, Property>& properties() const { return mProperties; }
 
-	TPM_NODISCARD inline Property& operator[](const std::string& key) { return mProperties[key]; }
+	/// Changes done via the returned reference after the next call to hash() are not detected
+	TPM_NODISCARD inline Property& operator[](const std::string& key)
+	{
+		if (mJournal)
+			recordProperty(key, PT_NONE);
+		invalidateHash(true);
+		return mProperties[key];
+	}
 	TPM_NODISCARD inline Property operator[](const std::string& key) const { return property(key); }
 
-	inline void addAnonymousChild(const std::shared_ptr<Object>& obj) { mChildren.push_back(obj); }
+	/// Null is ignored
+	inline void addAnonymousChild(const std::shared_ptr<Object>& obj)
+	{
+		if (!obj)
+			return;
+		obj->addOwner(this);
+		mChildren.push_back(obj);
+		mOrderedChildren.push_back(ObjectChild{ std::string(), obj.get() });
+		if (mJournal)
+			recordChild(std::string(), obj);
+		invalidateHash(false);
+	}
 	TPM_NODISCARD inline const std::vector<std::shared_ptr<Object>>& anonymousChildren() const { return mChildren; }
 
-	inline void addNamedChild(const std::string& key, const std::shared_ptr<Object>& obj) { mNamedChildren[key] = obj; }
+	/// Replaces the child with the same name, or removes it if null is given. The replaced child and its descendants stop
+	/// recording to the journal, even if they are still referenced elsewhere
+	inline void addNamedChild(const std::string& key, const std::shared_ptr<Object>& obj)
+	{
+		const auto it = mNamedChildren.find(key);
+		if (it == mNamedChildren.end() && !obj)
+			return;
+
+		if (it != mNamedChildren.end()) {
+			for (auto child = mOrderedChildren.begin(); child != mOrderedChildren.end(); ++child) {
+				if (child->object == it->second.get() && child->name == key) {
+					if (obj)
+						child->object = obj.get();
+					else
+						mOrderedChildren.erase(child);
+					break;
+				}
+			}
+			if (mJournal && it->second != obj)
+				it->second->detachJournal(mJournal.get());
+			it->second->removeOwner(this);
+			if (obj)
+				it->second = obj;
+			else
+				mNamedChildren.erase(it);
+		} else {
+			mOrderedChildren.push_back(ObjectChild{ key, obj.get() });
+			mNamedChildren.emplace(key, obj);
+		}
+
+		if (obj)
+			obj->addOwner(this);
+		if (mJournal)
+			recordChild(key, obj);
+		invalidateHash(false);
+	}
 	TPM_NODISCARD inline const std::unordered_map<std::string, std::shared_ptr<Object>>& namedChildren() const { return mNamedChildren; }
 	TPM_NODISCARD inline std::shared_ptr<Object> namedChild(const std::string& key) const
 	{
 		return mNamedChildren.count(key) ? mNamedChildren.at(key) : nullptr;
 	}
 
+	/// Struct created by a plugin binding, see SceneLoader::bindPlugin. Null if not bound or bound to a different type
+	template <typename T>
+	TPM_NODISCARD inline T* boundData() const
+	{
+		return mBoundType == &BindingTag<T>::id ? static_cast<T*>(mBound.get()) : nullptr;
+	}
+	template <typename T>
+	inline void setBoundData(const std::shared_ptr<T>& data)
+	{
+		mBound	   = data;
+		mBoundType = &BindingTag<T>::id;
+	}
+	TPM_NODISCARD inline bool hasBoundData() const { return mBound != nullptr; }
+
+	/// Anonymous and named children in document order
+	TPM_NODISCARD inline const std::vector<ObjectChild>& children() const { return mOrderedChildren; }
+
+	/// Structural hash of the type, plugin type, id, properties and all children (recursively), but not the bound data.
+	/// Computed while loading (on first use with lazy properties) and cached afterwards. Changes of this object or any descendant are detected.
+	/// A change invalidates the cached hash of the changed object and of its ancestors only, following all objects holding it as child.
+	/// Recomputing an invalidated object rehashes its changed properties and combines the cached hashes of its direct children,
+	/// therefore unchanged subtrees are not walked again.
+	/// Not thread-safe
+	TPM_NODISCARD uint64_t hash() const;
+
+	/// Journal edits of this object are recorded to, see Scene::enableJournal. Null if not recording
+	TPM_NODISCARD inline ChangeJournal* journal() const { return mJournal.get(); }
+
+	/// First object containing this one. Only available if loaded with SceneLoader::enableParentLinks,
+	/// null for top-level objects as the scene itself might be moved
+	TPM_NODISCARD inline Object* parent() const { return mParent; }
+
+	/// Calls visitor(const ObjectVisit&) for this object and all its descendants in document order.
+	/// Returning false from the visitor skips the children of the visited object.
+	/// Objects referenced multiple times are visited once per parent
+	template <typename Visitor>
+	inline void visitDepthFirst(Visitor visitor) const;
+	/// Same as visitDepthFirst but level by level. The queue can be reused between calls to prevent allocations
+	template <typename Visitor>
+	inline void visitBreadthFirst(Visitor visitor, std::vector<ObjectVisit>* queue = nullptr) const;
+
 private:
+	template <typename Visitor>
+	inline void visitDepthFirst(Visitor& visitor, const Object* parent, const char* slot, size_t depth) const;
+
+	void addOwner(Object* owner);
+	void removeOwner(Object* owner);
+	void adoptChildren();
+	void releaseChildren();
+	void invalidateHash(bool properties);
+	void recordProperty(const std::string& key, PropertyType newType);
+	void recordChild(const std::string& key, const std::shared_ptr<Object>& child);
+	void attachJournal(const std::shared_ptr<ChangeJournal>& journal);
+	void detachJournal(const ChangeJournal* journal);
+
 	ObjectType mType;
 	std::string mPluginType;
 	std::string mID;
 	std::unordered_map<std::string, Property> mProperties;
 	std::vector<std::shared_ptr<Object>> mChildren;
 	std::unordered_map<std::string, std::shared_ptr<Object>> mNamedChildren;
+	std::vector<ObjectChild> mOrderedChildren;
+	Object* mParent = nullptr;
+	std::shared_ptr<void> mBound;
+	const void* mBoundType = nullptr;
+
+	// Objects holding this one as child, once per slot. Widely shared objects switch to counts to keep removal cheap
+	std::vector<Object*> mOwners;
+	std::unique_ptr<std::unordered_map<Object*, size_t>> mOwnerCounts;
+
+	// A valid hash implies valid hashes of all children, therefore invalidation stops at objects already invalid
+	mutable uint64_t mHash			  = 0;
+	mutable bool mHashValid			  = false;
+	mutable uint64_t mPropertiesHash  = 0;
+	mutable bool mPropertiesHashValid = false;
+
+	std::shared_ptr<ChangeJournal> mJournal;
+	uint64_t mJournalGeneration = 0; // Generation of the journal this object was last listed as dirty in
+};
+
+/// Single step of a traversal
+struct TPM_LIB ObjectVisit {
+	const Object* object;
+	const Object* parent; // Null for the object the traversal started at
+	const char* slot;	  // Name of the child in the parent, empty for anonymous children
+	size_t depth;
 };
 
+template <typename Visitor>
+inline void Object::visitDepthFirst(Visitor visitor) const
+{
+	visitDepthFirst(visitor, nullptr, "", 0);
+}
+
+template <typename Visitor>
+inline void Object::visitDepthFirst(Visitor& visitor, const Object* parent, const char* slot, size_t depth) const
+{
+	if (!visitor(ObjectVisit{ this, parent, slot, depth }))
+		return;
+
+	for (const auto& child : mOrderedChildren)
+		child.object->visitDepthFirst(visitor, this, child.name.c_str(), depth + 1);
+}
+
+template <typename Visitor>
+inline void Object::visitBreadthFirst(Visitor visitor, std::vector<ObjectVisit>* queue) const
+{
+	std::vector<ObjectVisit> localQueue;
+	std::vector<ObjectVisit>& q = queue ? *queue : localQueue;
+	q.clear();
+	q.push_back(ObjectVisit{ this, nullptr, "", 0 });
+
+	for (size_t i = 0; i < q.size(); ++i) {
+		const ObjectVisit visit = q[i];
+		if (!visitor(visit))
+			continue;
+
+		for (const auto& child : visit.object->mOrderedChildren)
+			q.push_back(ObjectVisit{ child.object, visit.object, child.name.c_str(), visit.depth + 1 });
+	}
+}
+
 // --------------- Scene
+/// Savings of the deduplication done by the SceneLoader. Only objects without an id are considered
+struct TPM_LIB DeduplicationReport {
+	size_t objectsVisited	= 0;
+	size_t objectsShared	= 0;
+	size_t propertiesShared = 0;
+	std::array<size_t, _OT_COUNT> objectsSharedPerType{ {} };
+};
+
+/// Statistics of Scene::poolValues. A value is shared if an equal one was visited before.
+/// As transforms are stored inline, only those with a cached inverse can be shared, see SceneLoader::enableTransformInverseCaching
+struct TPM_LIB PoolReport {
+	size_t spectraVisited	 = 0;
+	size_t spectraShared	 = 0;
+	size_t transformsVisited = 0;
+	size_t transformsShared	 = 0;
+
+	TPM_NODISCARD inline size_t uniqueSpectra() const { return spectraVisited - spectraShared; }
+	TPM_NODISCARD inline size_t uniqueTransforms() const { return transformsVisited - transformsShared; }
+	TPM_NODISCARD inline double spectrumHitRate() const { return spectraVisited ? double(spectraShared) / spectraVisited : 0.0; }
+	TPM_NODISCARD inline double transformHitRate() const { return transformsVisited ? double(transformsShared) / transformsVisited : 0.0; }
+};
+
+/// World transforms of all shapes and sensors in a contiguous SoA layout. Shapes inside a shapegroup appear once
+/// per instance referencing the group, groups which are not instantiated are skipped. Sensors attached to a shape follow its row.
+/// Rows are in document order
+struct TPM_LIB TransformTable {
+	std::vector<const Object*> objects;
+	std::vector<const Object*> instances; // The instance the row stems from or null
+	std::vector<ObjectType> types;
+	std::vector<Transform> toWorld;
+	std::vector<Transform> toLocal;
+	std::vector<uint8_t> invertible; // Zero if the world transform is singular, toLocal is the identity then
+	std::vector<uint8_t> animated;	 // One if the object or an instance above is animated, the transforms are at the first keyframe then
+
+	TPM_NODISCARD inline size_t size() const { return objects.size(); }
+};
+
+/// Reference to a row of a CompiledScene table
+struct TPM_LIB CompiledObjectRef {
+	ObjectType type;
+	uint32_t index;
+	int32_t slot; // Index into CompiledScene::slots or -1 for anonymous children
+};
+
+/// Values of a single property key and type for all rows of a CompiledObjectTable.
+/// Only the vector matching the type has one entry per row, the others are empty. Strings, spectra, blackbodies and animations
+/// are not render-ready values and are referenced via values instead. Rows without the property hold zero, the identity or null
+struct TPM_LIB CompiledColumn {
+	std::string key;
+	PropertyType type;
+	std::vector<uint8_t> present; // One if the row has the property with the given type
+	std::vector<Number> numbers;
+	std::vector<Integer> integers;
+	std::vector<uint8_t> bools;
+	std::vector<Vector> vectors;
+	std::vector<Color> colors;
+	std::vector<Transform> transforms;
+	std::vector<const Property*> values; // Points into the scene
+};
+
+/// All objects of a single type in a columnar layout. Rows are dense indices
+struct TPM_LIB CompiledObjectTable {
+	std::vector<const Object*> objects;
+	std::vector<uint32_t> pluginTypes; // Index into CompiledScene::pluginTypes
+	/// Columns of the common properties, see Scene::compile. Sorted by key and type
+	std::vector<CompiledColumn> columns;
+	/// Children of row i are children[childOffsets[i]] to children[childOffsets[i + 1]], named children are sorted by slot name
+	std::vector<uint32_t> childOffsets;
+	std::vector<CompiledObjectRef> children;
+
+	TPM_NODISCARD inline size_t size() const { return objects.size(); }
+	/// Null if the property is too rare for a column or not used at all
+	TPM_NODISCARD inline const CompiledColumn* column(const std::string& key, PropertyType type) const
+	{
+		for (const auto& column : columns) {
+			if (column.key == key && column.type == type)
+				return &column;
+		}
+		return nullptr;
+	}
+};
+
+/// Render-ready representation of a scene with one table per object type. Objects shared by multiple parents get a single row
+struct TPM_LIB CompiledScene {
+	std::array<CompiledObjectTable, _OT_COUNT> tables;
+	std::vector<std::string> pluginTypes; // Interned plugin types
+	std::vector<std::string> slots;		  // Interned names of named children
+	std::vector<CompiledObjectRef> roots; // Top-level objects of the scene
+
+	TPM_NODISCARD inline const CompiledObjectTable& table(ObjectType type) const { return tables[type]; }
+	TPM_NODISCARD inline const Object* object(const CompiledObjectRef& ref) const { return tables[ref.type].objects[ref.index]; }
+};
+
 class TPM_LIB Scene : public Object {
 	friend class InternalSceneLoader;
 
@@ -546,6 +1146,47 @@ public:
 	TPM_NODISCARD inline int versionMinor() const { return mVersionMinor; }
 	TPM_NODISCARD inline int versionPatch() const { return mVersionPatch; }
 
+	/// Empty if the scene was loaded without deduplication
+	TPM_NODISCARD inline const DeduplicationReport& deduplicationReport() const { return mDeduplicationReport; }
+
+	/// Let all properties with equal spectra share a single spectrum and all transform properties with equal matrices
+	/// share a single cached inverse. The pool is kept, such that properties added later on can be pooled by calling this again.
+	/// Lazy properties which were not decoded yet are skipped, decoded ones are replaced by their plain value
+	void poolValues();
+	/// Statistics of the last call of poolValues
+	TPM_NODISCARD inline const PoolReport& poolReport() const { return mPoolReport; }
+
+	/// Collect the world transforms of all shapes and sensors. Top-level objects are processed by the given number of threads,
+	/// zero uses all available hardware threads
+	TPM_NODISCARD TransformTable flattenTransforms(size_t threadCount = 1) const;
+
+	/// Convert the object tree into per type tables. Columns are only built for property keys (and types) used by at least
+	/// the given share of the rows of a table, rarer properties are available via the objects. Zero builds columns for all properties.
+	/// The scene has to outlive the result and must not be changed meanwhile
+	TPM_NODISCARD CompiledScene compile(Number minKeyUsage = Number(0.01)) const;
+
+	/// Object with the given id or alias, null if not available
+	TPM_NODISCARD std::shared_ptr<Object> findByID(const std::string& id) const;
+	/// All ids and aliases
+	TPM_NODISCARD inline const std::unordered_map<std::string, std::shared_ptr<Object>>& ids() const { return mIDs; }
+
+	/// Record all following edits done via Object::setProperty, Object::operator[], Object::addAnonymousChild and Object::addNamedChild
+	/// on the scene or any of its descendants. Objects added later on are recorded as well.
+	/// Objects shared with another scene record to the journal enabled last. Does nothing if already enabled
+	void enableJournal();
+	void disableJournal();
+
+	/// Objects containing the given object with an id, either via a reference or as a direct child.
+	/// The scene itself is not listed
+	TPM_NODISCARD const std::vector<Object*>& referrers(const Object* obj) const;
+	TPM_NODISCARD const std::vector<Object*>& referrers(const std::string& id) const;
+
+	/// Indices built while loading. Every object is listed once in document order, the scene itself is not listed.
+	/// The indices are a snapshot, objects added or replaced afterwards are not reflected. Use visitDepthFirst to walk the current tree
+	TPM_NODISCARD inline const std::vector<Object*>& objectsOfType(ObjectType type) const { return mTypeIndex[type]; }
+	TPM_NODISCARD const std::vector<Object*>& objectsOfType(ObjectType type, const std::string& pluginType) const;
+	TPM_NODISCARD const std::vector<Object*>& objectsWithProperty(const std::string& key) const;
+
 private:
 	inline Scene()
 		: Object(OT_SCENE, "", "")
@@ -555,43 +1196,290 @@ private:
 	int mVersionMajor;
 	int mVersionMinor;
 	int mVersionPatch;
+	DeduplicationReport mDeduplicationReport;
+	std::shared_ptr<ValuePool> mPool;
+	PoolReport mPoolReport;
+	std::unordered_map<std::string, std::shared_ptr<Object>> mIDs;
+	std::unordered_map<const Object*, std::vector<Object*>> mReferrers;
+	std::array<std::vector<Object*>, _OT_COUNT> mTypeIndex;
+	std::array<std::unordered_map<std::string, std::vector<Object*>>, _OT_COUNT> mPluginTypeIndex;
+	std::unordered_map<std::string, std::vector<Object*>> mPropertyIndex;
+};
+
+// --------------- Change Journal
+enum ChangeKind {
+	CK_PROPERTY = 0,
+	CK_ANONYMOUS_CHILD,
+	CK_NAMED_CHILD
+};
+
+struct TPM_LIB ChangeEvent {
+	ChangeKind kind;
+	Object* object;		  // Not owned, dangles if the object was removed from the scene and destroyed afterwards
+	std::string key;	  // Property key or child name, empty for anonymous children
+	PropertyType oldType; // PT_NONE if the property did not exist before
+	PropertyType newType; // PT_NONE if written via Object::operator[], as the new value is not known yet
+};
+
+/// Edits of a scene in the order they were done, see Scene::enableJournal.
+/// Not thread-safe, edits and draining have to be synchronized by the user
+class TPM_LIB ChangeJournal {
+	friend class Object;
+
+public:
+	TPM_NODISCARD inline const std::vector<ChangeEvent>& events() const { return mEvents; }
+	TPM_NODISCARD inline bool empty() const { return mEvents.empty(); }
+
+	/// Every object with at least one event since the last drain and still recording, listed once in order of their first event
+	TPM_NODISCARD inline const std::vector<Object*>& dirtyObjects() const { return mDirty; }
+
+	/// Move all events into the given vector, which is cleared beforehand, and start over.
+	/// Swapping the same vector back and forth reuses its memory
+	void drain(std::vector<ChangeEvent>& events);
+	TPM_NODISCARD inline std::vector<ChangeEvent> drain()
+	{
+		std::vector<ChangeEvent> events;
+		drain(events);
+		return events;
+	}
+
+private:
+	std::vector<ChangeEvent> mEvents;
+	std::vector<Object*> mDirty;
+	uint64_t mGeneration = 1;
+};
+
+// --------------- Diff
+enum DiffKind {
+	DK_ADDED = 0,
+	DK_REMOVED,
+	DK_MODIFIED
+};
+
+/// Object added or removed as a whole, or whose own properties changed (DK_MODIFIED).
+/// Paths consist of the segments between the scene and the object, separated by '/'. Anonymous children are given as
+/// 'type#id' if they have an id and as 'type[n]' with n being the index among their siblings of the same type without id otherwise.
+/// Named children are given by their name
+struct TPM_LIB ObjectDiff {
+	DiffKind kind;
+	std::string path;
+	const Object* before; // Null if added
+	const Object* after;  // Null if removed
+};
+
+struct TPM_LIB PropertyDiff {
+	DiffKind kind;
+	std::string path; // Path of the object containing the property
+	std::string key;
+	Property before; // Invalid if added
+	Property after;	 // Invalid if removed
+};
+
+struct TPM_LIB SceneDiff {
+	std::vector<ObjectDiff> objects;
+	std::vector<PropertyDiff> properties;
+
+	TPM_NODISCARD inline bool empty() const { return objects.empty() && properties.empty(); }
+};
+
+/// Changes required to get from one scene to the other. Subtrees with equal Object::hash are skipped, therefore
+/// with cached hashes the time spent depends on the changed objects and their siblings, not on the size of the scenes.
+/// Anonymous children are paired by id and index. If children were inserted or removed, unchanged ones are paired by hash first.
+/// Descendants of added or removed objects are not listed. The scenes have to outlive the result
+TPM_NODISCARD TPM_LIB SceneDiff diff(const Scene& before, const Scene& after);
+
+// --------------- Spectrum Resampling
+/// Samples spectra at the wavelengths start, start + step, ... up to end (inclusive) as given by Spectrum::evaluate.
+/// Results are cached per distinct spectrum and stay valid as long as the resampler exists. Not thread-safe
+class TPM_LIB SpectrumResampler {
+public:
+	explicit SpectrumResampler(Number start = Number(360), Number end = Number(830), Number step = Number(5));
+
+	SpectrumResampler(const SpectrumResampler& other) = delete;
+	SpectrumResampler(SpectrumResampler&& other)	  = default;
+
+	SpectrumResampler& operator=(const SpectrumResampler& other) = delete;
+	SpectrumResampler& operator=(SpectrumResampler&& other)		 = default;
+
+	TPM_NODISCARD inline Number start() const { return mStart; }
+	TPM_NODISCARD inline Number step() const { return mStep; }
+	TPM_NODISCARD inline size_t sampleCount() const { return mSampleCount; }
+	TPM_NODISCARD inline Number wavelength(size_t i) const { return mStart + i * mStep; }
+
+	/// The sampleCount() samples of the spectrum
+	TPM_NODISCARD const Number* resample(const Spectrum& spectrum);
+	/// Resample all spectrum properties of the scene. New spectra are processed by the given number of threads,
+	/// zero uses all available hardware threads. Returns the number of distinct spectra in the scene
+	size_t resample(const Scene& scene, size_t threadCount = 1);
+
+	/// Linear interpolation of the resampled spectrum, zero outside of the sampled range
+	void evaluate(const Spectrum& spectrum, const Number* wavelengths, Number* out, size_t count);
+
+	TPM_NODISCARD inline size_t cacheSize() const { return mCacheSize; }
+	void clearCache();
+
+private:
+	struct CacheEntry {
+		Spectrum spectrum;
+		std::vector<Number> samples;
+	};
+
+	CacheEntry* findOrInsert(const Spectrum& spectrum, bool* inserted);
+	void sample(CacheEntry& entry) const;
+
+	Number mStart;
+	Number mStep;
+	size_t mSampleCount;
+	size_t mCacheSize;
+	std::unordered_map<uint64_t, std::vector<std::unique_ptr<CacheEntry>>> mCache;
+};
+
+// --------------- Color Conversion
+enum ColorSpace {
+	CS_LINEAR_SRGB = 0, // sRGB primaries and D65 white point without the transfer function
+	CS_XYZ				// CIE 1931 XYZ
+};
+
+/// Converts color, spectrum and blackbody values into a working color space.
+/// Colors are expected as linear sRGB and uniform spectra are treated as grey values.
+/// Other spectra are integrated against the CIE 1931 color matching functions (analytic fit by Wyman et al.),
+/// sampled from 360 to 830 nm in 1 nm steps and normalized such that a constant spectrum of one has a luminance of one.
+/// The equal energy white of integrated spectra is adapted to D65 (Bradford), such that a constant spectrum matches a uniform one.
+/// Blackbodies are integrated the same way from their spectral radiance in W/(m^2 sr nm) like Mitsuba does, the scale is applied afterwards.
+/// Results are cached per distinct spectrum and temperature. Not thread-safe
+class TPM_LIB ColorConverter {
+public:
+	explicit ColorConverter(ColorSpace space = CS_LINEAR_SRGB);
+
+	TPM_NODISCARD inline ColorSpace colorSpace() const { return mColorSpace; }
+
+	TPM_NODISCARD Color convert(const Color& rgb) const;
+	TPM_NODISCARD Color convert(const Spectrum& spectrum);
+	TPM_NODISCARD Color convert(const Blackbody& blackbody);
+	/// Invalid property if the given one is not a color, spectrum or blackbody
+	TPM_NODISCARD Property convert(const Property& property);
+	/// Blackbodies with the given temperatures (in Kelvin) and a scale of one.
+	/// Throws std::runtime_error if a temperature is not finite, non-positive temperatures are black
+	void convertBlackbodies(const Number* temperatures, Color* out, size_t count);
+
+	/// Replace all color, spectrum and blackbody properties of the scene by colors in the working color space.
+	/// New spectra are processed by the given number of threads, zero uses all available hardware threads.
+	/// Returns the number of replaced properties
+	size_t convert(Scene& scene, size_t threadCount = 1);
+
+	TPM_NODISCARD inline size_t cacheSize() const { return mSpectrumCacheSize + mBlackbodyCache.size(); }
+	void clearCache();
+
+private:
+	struct SpectrumEntry {
+		Spectrum spectrum;
+		Color xyz;
+	};
+
+	SpectrumEntry* findOrInsert(const Spectrum& spectrum, bool* inserted);
+	Color fromXYZ(const Color& xyz) const;
+
+	ColorSpace mColorSpace;
+	size_t mSpectrumCacheSize;
+	std::unordered_map<uint64_t, std::vector<std::unique_ptr<SpectrumEntry>>> mSpectrumCache;
+	std::unordered_map<Number, Color> mBlackbodyCache; // Adapted XYZ per temperature
+};
+
+// --------------- SceneHandler
+/// Callbacks used by SceneLoader::parseFromFile and SceneLoader::parseFromString. No objects are created,
+/// references and aliases are reported by id only. The scene itself is reported as an object of type OT_SCENE
+class TPM_LIB SceneHandler {
+public:
+	virtual ~SceneHandler() = default;
+
+	/// Name is the slot inside the parent object and empty for anonymous objects
+	virtual void onObjectBegin(ObjectType /*type*/, const std::string& /*pluginType*/, const std::string& /*id*/, const std::string& /*name*/) {}
+	virtual void onProperty(const std::string& /*name*/, const Property& /*property*/) {}
+	/// Name is empty for anonymous references
+	virtual void onReference(const std::string& /*id*/, const std::string& /*name*/) {}
+	virtual void onAlias(const std::string& /*id*/, const std::string& /*as*/) {}
+	virtual void onObjectEnd(ObjectType /*type*/) {}
 };
 
 // --------------- SceneLoader
+/// Outcome of a single file loaded via SceneLoader::loadBatch. Either scene is set or error contains the reason of failure
+struct TPM_LIB BatchLoadResult {
+	std::string path;
+	std::shared_ptr<Scene> scene;
+	std::string error;
+
+	TPM_NODISCARD inline bool isValid() const { return scene != nullptr; }
+};
+
+/// Fields of a plugin and a callback creating the struct they are written to
+struct TPM_LIB PluginBinding {
+	std::vector<FieldBinding> fields;
+	std::function<void*(Object&)> attach; // Creates and attaches the struct to the object and returns its address
+};
+
+/// Loading does not modify the loader, therefore a single instance can be used by multiple threads at once,
+/// as long as its configuration is not changed at the same time
 class TPM_LIB SceneLoader {
 	friend class InternalSceneLoader;
 
 public:
 	inline SceneLoader() = default;
 
-	TPM_NODISCARD inline Scene loadFromFile(const std::string& path)
+	TPM_NODISCARD inline Scene loadFromFile(const std::string& path) const
 	{
 		return loadFromFile(path.c_str());
 	}
 
-	TPM_NODISCARD inline Scene loadFromString(const std::string& str)
+	TPM_NODISCARD inline Scene loadFromString(const std::string& str) const
 	{
 		return loadFromString(str.c_str());
 	}
 
 #ifdef TPM_HAS_STRING_VIEW
-	TPM_NODISCARD inline Scene loadFromString(const std::string_view& str)
+	TPM_NODISCARD inline Scene loadFromString(const std::string_view& str) const
 	{
 		return loadFromString(str.data(), str.size());
 	}
 #endif
 
+	/// Load only the object with the given id and everything it references (directly, via aliases or includes).
+	/// Unrelated objects and includes are skipped
+	TPM_NODISCARD inline std::shared_ptr<Object> loadObjectById(const std::string& path, const std::string& id) const
+	{
+		return loadObjectById(path.c_str(), id.c_str());
+	}
+
+	/// Walk the scene with all arguments, defaults and includes applied and report the content to the handler.
+	/// No objects are built, but the XML document (and the include currently walked) is still loaded into memory completely
+	inline void parseFromFile(const std::string& path, SceneHandler& handler) const
+	{
+		parseFromFile(path.c_str(), handler);
+	}
+
+	inline void parseFromString(const std::string& str, SceneHandler& handler) const
+	{
+		parseFromString(str.c_str(), handler);
+	}
+
 	// TPM_NODISCARD static Scene loadFromStream(std::istream& stream);
 
-	TPM_NODISCARD Scene loadFromFile(const char* path);
-	TPM_NODISCARD Scene loadFromString(const char* str);
-	TPM_NODISCARD Scene loadFromString(const char* str, size_t max_len);
-	TPM_NODISCARD Scene loadFromMemory(const uint8_t* data, size_t size);
+	TPM_NODISCARD Scene loadFromFile(const char* path) const;
+	TPM_NODISCARD Scene loadFromString(const char* str) const;
+	TPM_NODISCARD Scene loadFromString(const char* str, size_t max_len) const;
+	TPM_NODISCARD Scene loadFromMemory(const uint8_t* data, size_t size) const;
+	TPM_NODISCARD std::shared_ptr<Object> loadObjectById(const char* path, const char* id) const;
+	void parseFromFile(const char* path, SceneHandler& handler) const;
+	void parseFromString(const char* str, SceneHandler& handler) const;
+
+	/// Load multiple files concurrently with at most threadCount threads (zero uses all available cores).
+	/// Resolved paths and included files are shared between the loads running at the same time. The results have the same order as the given paths
+	TPM_NODISCARD std::vector<BatchLoadResult> loadBatch(const std::vector<std::string>& paths, size_t threadCount = 0) const;
 
 	inline void addLookupDir(const std::string& path)
 	{
 		mLookupPaths.push_back(path);
 	}
+	TPM_NODISCARD inline const std::vector<std::string>& lookupPaths() const { return mLookupPaths; }
 
 	inline void addArgument(const std::string& key, const std::string& value)
 	{
@@ -601,9 +1489,74 @@ public:
 	inline void disableLowerCaseConversion(bool b = true) { mDisableLowerCaseConversion = b; }
 	inline bool isLowerCaseConversionDisabled() const { return mDisableLowerCaseConversion; }
 
+	/// Only parse objects whose type is part of the given mask (build it with objectTypeMask).
+	/// An object is only kept if its parents are kept as well. Subtrees of other types are skipped
+	/// and only parsed if they are referenced by a kept object. The scene itself is always kept
+	inline void setObjectFilter(uint32_t mask) { mObjectFilter = mask; }
+	inline uint32_t objectFilter() const { return mObjectFilter; }
+
+	/// Share structurally identical objects without an id (e.g., repeated inline bsdfs) between their parents.
+	/// Changing a shared object afterwards affects all its parents
+	inline void enableDeduplication(bool b = true) { mDeduplicate = b; }
+	inline bool isDeduplicationEnabled() const { return mDeduplicate; }
+
+	/// Compute the inverse and normal matrix of all transform properties once while loading. Singular transforms are not cached.
+	/// See Property::getTransformInverse and Property::getTransformNormal
+	inline void enableTransformInverseCaching(bool b = true) { mCacheTransformInverse = b; }
+	inline bool isTransformInverseCachingEnabled() const { return mCacheTransformInverse; }
+
+	/// Keep the list of operations of transform properties and a TRS decomposition if possible.
+	/// See Property::getTransformDecomposition
+	inline void enableTransformDecomposition(bool b = true) { mDecomposeTransforms = b; }
+	inline bool isTransformDecompositionEnabled() const { return mDecomposeTransforms; }
+
+	/// Properties of objects with the given type and plugin type matching a field are written into a new instance of T,
+	/// instead of being added to the object. See Object::boundData and TPM_BIND_FIELD.
+	/// Properties of a different type than the field are added to the object as usual. Bound objects are never deduplicated
+	template <typename T>
+	inline void bindPlugin(ObjectType type, const std::string& pluginType, const std::vector<FieldBinding>& fields,
+						   const std::function<T*()>& factory = nullptr)
+	{
+		mBindings[type][pluginType] = PluginBinding{ fields, [factory](Object& obj) { return attachBoundData<T>(obj, factory); } };
+	}
+	inline void unbindPlugin(ObjectType type, const std::string& pluginType) { mBindings[type].erase(pluginType); }
+	/// Null if not bound
+	TPM_NODISCARD const PluginBinding* pluginBinding(ObjectType type, const std::string& pluginType) const;
+
+	/// Set Object::parent for all loaded objects
+	inline void enableParentLinks(bool b = true) { mParentLinks = b; }
+	inline bool isParentLinksEnabled() const { return mParentLinks; }
+
+	/// Keep the documents alive and only decode spectra, transforms and animations on first access, other values are small
+	/// and decoded immediately. The type of a property is known upfront, its value (and validity) is not. Arguments and defaults
+	/// are applied as visible at the property. Properties of bound objects are always decoded immediately
+	/// and deduplication decodes all properties it compares
+	inline void enableLazyProperties(bool b = true) { mLazyProperties = b; }
+	inline bool isLazyPropertiesEnabled() const { return mLazyProperties; }
+
+	/// Call Scene::poolValues after loading
+	inline void enableValuePooling(bool b = true) { mPoolValues = b; }
+	inline bool isValuePoolingEnabled() const { return mPoolValues; }
+
 private:
+	template <typename T>
+	static void* attachBoundData(Object& obj, const std::function<T*()>& factory)
+	{
+		std::shared_ptr<T> data(factory ? factory() : new T());
+		obj.setBoundData(data);
+		return data.get();
+	}
+
 	std::vector<std::string> mLookupPaths;
 	std::unordered_map<std::string, std::string> mArguments;
 	bool mDisableLowerCaseConversion = false;
+	uint32_t mObjectFilter			 = OTM_ALL;
+	bool mDeduplicate				 = false;
+	bool mCacheTransformInverse		 = false;
+	bool mDecomposeTransforms		 = false;
+	bool mParentLinks				 = false;
+	bool mLazyProperties			 = false;
+	bool mPoolValues				 = false;
+	std::array<std::unordered_map<std::string, PluginBinding>, _OT_COUNT> mBindings;
 };
 } // namespace TPM_NAMESPACE
\ No newline at end of file
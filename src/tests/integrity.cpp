@@ -3,6 +3,12 @@
 
 #include "tinyparser-mitsuba.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
 using namespace TPM_NAMESPACE;
 
 TEST_CASE("Version Detection", "[integrity]")
@@ -84,6 +90,21 @@ TEST_CASE("Spectrum", "[integrity]")
 	REQUIRE(weights[0] == 0.5);
 	REQUIRE(weights[1] == 1);
 	REQUIRE(weights[2] == 0.5);
+
+	// Fractional wavelengths and no upper bound on the number of samples
+	std::string samples;
+	for (int i = 0; i < 4000; ++i)
+		samples += std::to_string(360 + i * 0.125) + ":" + std::to_string(i % 7) + ", ";
+	scene = loader.loadFromString("<scene version='0.6'><spectrum name='test' value='" + samples + "' /></scene>");
+	prop  = scene["test"];
+	REQUIRE(prop.getSpectrum().wavelengths().size() == 4000);
+	REQUIRE(prop.getSpectrum().weights().size() == 4000);
+	REQUIRE(prop.getSpectrum().wavelengths()[1] == Number(360.125));
+	REQUIRE(prop.getSpectrum().wavelengths()[3999] == Number(360 + 3999 * 0.125));
+	REQUIRE(prop.getSpectrum().weights()[3999] == Number(3999 % 7));
+
+	scene = loader.loadFromString("<scene version='0.6'><spectrum name='test' value='400:1, 500' /></scene>");
+	REQUIRE(!scene["test"].isValid());
 }
 
 TEST_CASE("Transform", "[integrity]")
@@ -109,4 +130,824 @@ TEST_CASE("Transform", "[integrity]")
 	scene = loader.loadFromString("<scene version='0.6'><transform name='test'><scale z='6'/></transform></scene>");
 	prop  = scene["test"];
 	REQUIRE(prop.getTransform() == v4);
-}
\ No newline at end of file
+}
+TEST_CASE("Object Filter", "[integrity]")
+{
+	SceneLoader loader;
+	loader.setObjectFilter(objectTypeMask(OT_SENSOR) | objectTypeMask(OT_FILM) | objectTypeMask(OT_SHAPE));
+
+	auto scene = loader.loadFromString("<scene version='0.6'><default name='r' value='0.5'/>"
+									   "<bsdf type='diffuse' id='mat'><float name='r' value='$r'/></bsdf>"
+									   "<bsdf type='diffuse' id='unused'/>"
+									   "<texture type='bitmap'/>"
+									   "<sensor type='perspective'><film type='hdrfilm'/><sampler type='independent'/></sensor>"
+									   "<shape type='sphere'><ref id='mat'/></shape>"
+									   "</scene>");
+	REQUIRE(scene.anonymousChildren().size() == 2);
+
+	auto sensor = scene.anonymousChildren()[0];
+	REQUIRE(sensor->type() == OT_SENSOR);
+	REQUIRE(sensor->anonymousChildren().size() == 1);
+	REQUIRE(sensor->anonymousChildren()[0]->type() == OT_FILM);
+
+	auto shape = scene.anonymousChildren()[1];
+	REQUIRE(shape->type() == OT_SHAPE);
+	REQUIRE(shape->anonymousChildren().size() == 1);
+	REQUIRE(shape->anonymousChildren()[0]->id() == "mat");
+	REQUIRE(shape->anonymousChildren()[0]->property("r").getNumber() == Number(0.5));
+
+	// Nested objects inside skipped objects can be referenced as well
+	scene = loader.loadFromString("<scene version='0.6'>"
+								  "<bsdf type='twosided'><bsdf type='diffuse' id='inner'/></bsdf>"
+								  "<shape type='sphere'><ref id='inner'/></shape>"
+								  "</scene>");
+	REQUIRE(scene.anonymousChildren().size() == 1);
+	REQUIRE(scene.anonymousChildren()[0]->anonymousChildren()[0]->pluginType() == "diffuse");
+}
+
+TEST_CASE("Load Object By Id", "[integrity]")
+{
+	{
+		std::ofstream include("tpm_test_partial_include.xml");
+		include << "<scene version='0.6'><texture type='checkerboard' id='tex'/><bsdf type='diffuse' id='other'/></scene>";
+	}
+	{
+		std::ofstream main("tpm_test_partial_main.xml");
+		main << "<scene version='0.6'>"
+				"<include filename='tpm_test_partial_include.xml'/>"
+				"<shape type='sphere'><bsdf type='diffuse' id='unrelated'/></shape>"
+				"<alias id='tex' as='albedo'/>"
+				"<bsdf type='diffuse' id='mat'><ref name='reflectance' id='albedo'/></bsdf>"
+				"<include filename='tpm_test_partial_missing.xml'/>" // Never loaded
+				"</scene>";
+	}
+
+	SceneLoader loader;
+	auto obj = loader.loadObjectById("tpm_test_partial_main.xml", "mat");
+	REQUIRE(obj);
+	REQUIRE(obj->type() == OT_BSDF);
+	REQUIRE(obj->namedChild("reflectance"));
+	REQUIRE(obj->namedChild("reflectance")->pluginType() == "checkerboard");
+
+	auto build = [&]() { auto o = loader.loadObjectById("tpm_test_partial_main.xml", "unknown"); (void)o; };
+	CHECK_THROWS(build());
+
+	std::remove("tpm_test_partial_main.xml");
+	std::remove("tpm_test_partial_include.xml");
+}
+
+TEST_CASE("Load Batch", "[integrity]")
+{
+	{
+		std::ofstream include("tpm_test_batch_include.xml");
+		include << "<scene version='0.6'><bsdf type='diffuse' id='mat'><spectrum name='tint' value='0.25'/></bsdf></scene>";
+	}
+
+	std::vector<std::string> paths;
+	for (int i = 0; i < 8; ++i) {
+		const std::string path = "tpm_test_batch_" + std::to_string(i) + ".xml";
+		std::ofstream file(path);
+		file << "<scene version='0.6'><include filename='tpm_test_batch_include.xml'/>"
+			 << "<integer name='index' value='" << i << "'/>"
+			 << "<shape type='sphere'><ref id='mat'/></shape></scene>";
+		paths.push_back(path);
+	}
+	paths.push_back("tpm_test_batch_missing.xml");
+
+	SceneLoader loader;
+	const auto results = loader.loadBatch(paths, 4);
+	REQUIRE(results.size() == paths.size());
+	for (int i = 0; i < 8; ++i) {
+		REQUIRE(results[i].isValid());
+		REQUIRE(results[i].path == paths[i]);
+		REQUIRE(results[i].scene->property("index").getInteger() == i);
+		REQUIRE(results[i].scene->anonymousChildren().size() == 2);
+	}
+	REQUIRE(!results.back().isValid());
+	REQUIRE(!results.back().error.empty());
+
+	// Includes shared between the scenes are decoded lazily from multiple threads
+	loader.enableLazyProperties();
+	paths.pop_back();
+	const auto lazyResults = loader.loadBatch(paths, 4);
+	std::vector<std::thread> threads;
+	std::atomic<int> matches(0);
+	for (const auto& result : lazyResults) {
+		threads.emplace_back([&]() {
+			if (result.scene->findByID("mat")->property("tint").getSpectrum().uniformValue() == 0.25f)
+				++matches;
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	REQUIRE(matches == 8);
+
+	for (int i = 0; i < 8; ++i)
+		std::remove(paths[i].c_str());
+	std::remove("tpm_test_batch_include.xml");
+}
+
+TEST_CASE("Shared Loader", "[integrity]")
+{
+	{
+		std::ofstream file("tpm_test_shared.xml");
+		file << "<scene version='0.6'><default name='radius' value='1'/>"
+				"<shape type='sphere'><float name='radius' value='$radius'/></shape></scene>";
+	}
+
+	// A single loader is used by all threads at once
+	SceneLoader loader;
+	loader.addArgument("radius", "2");
+
+	std::atomic<int> successes(0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; ++t) {
+		threads.emplace_back([&]() {
+			for (int i = 0; i < 16; ++i) {
+				const auto scene = loader.loadFromFile("tpm_test_shared.xml");
+				if (scene.anonymousChildren().size() == 1
+					&& scene.anonymousChildren()[0]->property("radius").getNumber() == Number(2))
+					++successes;
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	REQUIRE(successes == 8 * 16);
+	std::remove("tpm_test_shared.xml");
+}
+
+TEST_CASE("Deduplication", "[integrity]")
+{
+	const char* str = "<scene version='0.6'>"
+					  "<shape type='sphere'><bsdf type='diffuse'><rgb name='reflectance' value='0.5'/></bsdf></shape>"
+					  "<shape type='cube'><bsdf type='diffuse'><rgb name='reflectance' value='0.5'/></bsdf></shape>"
+					  "<shape type='cube'><bsdf type='diffuse'><rgb name='reflectance' value='0.2'/></bsdf></shape>"
+					  "</scene>";
+
+	SceneLoader loader;
+	auto scene = loader.loadFromString(str);
+	REQUIRE(scene.anonymousChildren()[0]->anonymousChildren()[0] != scene.anonymousChildren()[1]->anonymousChildren()[0]);
+	REQUIRE(scene.deduplicationReport().objectsShared == 0);
+
+	loader.enableDeduplication();
+	scene = loader.loadFromString(str);
+	REQUIRE(scene.anonymousChildren().size() == 3);
+	REQUIRE(scene.anonymousChildren()[0] != scene.anonymousChildren()[1]);
+	REQUIRE(scene.anonymousChildren()[0]->anonymousChildren()[0] == scene.anonymousChildren()[1]->anonymousChildren()[0]);
+	REQUIRE(scene.anonymousChildren()[1]->anonymousChildren()[0] != scene.anonymousChildren()[2]->anonymousChildren()[0]);
+
+	const auto& report = scene.deduplicationReport();
+	REQUIRE(report.objectsVisited == 6);
+	REQUIRE(report.objectsShared == 1);
+	REQUIRE(report.objectsSharedPerType[OT_BSDF] == 1);
+	REQUIRE(report.propertiesShared == 1);
+}
+
+TEST_CASE("Flatten Transforms", "[integrity]")
+{
+	const char* str = "<scene version='2.0.0'>"
+					  "<sensor type='perspective'><transform name='to_world'><translate x='1'/></transform></sensor>"
+					  "<shape type='shapegroup' id='group'>"
+					  "<shape type='sphere'><transform name='to_world'><translate y='1'/></transform></shape>"
+					  "<shape type='cube'/>"
+					  "</shape>"
+					  "<shape type='instance'><ref id='group'/><transform name='to_world'><scale value='2, 2, 2'/></transform></shape>"
+					  "<shape type='instance'><ref id='group'/><transform name='to_world'><translate z='5'/></transform></shape>"
+					  "<shape type='cube'/>"
+					  "<bsdf type='diffuse'/>"
+					  "</scene>";
+
+	SceneLoader loader;
+	const auto scene = loader.loadFromString(str);
+
+	const auto table = scene.flattenTransforms();
+	REQUIRE(table.size() == 6);
+	REQUIRE(table.types[0] == OT_SENSOR);
+	REQUIRE(table.toWorld[0](0, 3) == 1);
+	REQUIRE(table.instances[0] == nullptr);
+
+	// Sphere of the first instance
+	REQUIRE(table.objects[1]->pluginType() == "sphere");
+	REQUIRE(table.instances[1] == scene.anonymousChildren()[2].get());
+	REQUIRE(table.toWorld[1] == Transform::fromScale(Vector(2, 2, 2)) * Transform::fromTranslation(Vector(0, 1, 0)));
+	REQUIRE(table.toLocal[1] == table.toWorld[1].inverse());
+	REQUIRE(table.objects[2]->pluginType() == "cube");
+	REQUIRE(table.toWorld[2] == Transform::fromScale(Vector(2, 2, 2)));
+
+	// Second instance shares the objects
+	REQUIRE(table.objects[3] == table.objects[1]);
+	REQUIRE(table.toWorld[3] == Transform::fromTranslation(Vector(0, 1, 5)));
+	REQUIRE(table.instances[5] == nullptr);
+	REQUIRE(table.toWorld[5] == Transform::fromIdentity());
+
+	REQUIRE(table.invertible == std::vector<uint8_t>(6, 1));
+
+	const auto parallel = scene.flattenTransforms(4);
+	REQUIRE(parallel.objects == table.objects);
+	REQUIRE(parallel.instances == table.instances);
+	REQUIRE(parallel.toWorld == table.toWorld);
+
+	// Sensors attached to shapes follow them, singular transforms are reported
+	const auto attached = loader.loadFromString("<scene version='2.0.0'>"
+												"<shape type='rectangle'><transform name='to_world'><translate x='2'/></transform>"
+												"<sensor type='irradiancemeter'/></shape>"
+												"<shape type='disk'><transform name='to_world'><scale value='0, 1, 1'/></transform></shape>"
+												"</scene>");
+	const auto attachedTable = attached.flattenTransforms(2);
+	REQUIRE(attachedTable.size() == 3);
+	REQUIRE(attachedTable.types[1] == OT_SENSOR);
+	REQUIRE(attachedTable.toWorld[1] == Transform::fromTranslation(Vector(2, 0, 0)));
+	REQUIRE(attachedTable.invertible[1] == 1);
+	REQUIRE(attachedTable.invertible[2] == 0);
+	REQUIRE(attachedTable.toLocal[2] == Transform::fromIdentity());
+	REQUIRE(attachedTable.animated == std::vector<uint8_t>(3, 0));
+
+	// Animations are placed at their first keyframe, also for attached sensors
+	const auto animated = loader.loadFromString("<scene version='2.0.0'>"
+												"<shape type='rectangle'><animation name='to_world'>"
+												"<transform time='1'><translate x='3'/></transform>"
+												"<transform time='0'><translate x='1'/></transform>"
+												"</animation><sensor type='irradiancemeter'/></shape>"
+												"</scene>");
+	const auto animatedTable = animated.flattenTransforms();
+	REQUIRE(animatedTable.size() == 2);
+	REQUIRE(animatedTable.animated == std::vector<uint8_t>(2, 1));
+	REQUIRE(animatedTable.invertible == std::vector<uint8_t>(2, 1));
+	REQUIRE(animatedTable.toWorld[0] == Transform::fromTranslation(Vector(1, 0, 0)));
+	REQUIRE(animatedTable.toLocal[1] == Transform::fromTranslation(Vector(-1, 0, 0)));
+}
+
+TEST_CASE("Compile", "[integrity]")
+{
+	const char* str = "<scene version='0.6'>"
+					  "<bsdf type='diffuse' id='white'><rgb name='reflectance' value='1'/></bsdf>"
+					  "<shape type='sphere'><float name='radius' value='2'/><ref id='white'/></shape>"
+					  "<shape type='cube'><ref name='bsdf' id='white'/><emitter type='area'/></shape>"
+					  "<shape type='sphere'><bsdf type='conductor'/></shape>"
+					  "</scene>";
+
+	SceneLoader loader;
+	const auto scene	= loader.loadFromString(str);
+	const auto compiled = scene.compile();
+
+	REQUIRE(compiled.roots.size() == 4);
+	REQUIRE(compiled.table(OT_SHAPE).size() == 3);
+	REQUIRE(compiled.table(OT_BSDF).size() == 2);
+	REQUIRE(compiled.table(OT_EMITTER).size() == 1);
+
+	// Plugin types are interned
+	const auto& shapes = compiled.table(OT_SHAPE);
+	REQUIRE(shapes.pluginTypes[0] == shapes.pluginTypes[2]);
+	REQUIRE(compiled.pluginTypes[shapes.pluginTypes[1]] == "cube");
+
+	// Typed property columns with a presence mask
+	const auto radius = shapes.column("radius", PT_NUMBER);
+	REQUIRE(radius != nullptr);
+	REQUIRE(radius->numbers.size() == 3);
+	REQUIRE(radius->transforms.empty());
+	REQUIRE(radius->numbers[0] == 2);
+	REQUIRE(radius->present == std::vector<uint8_t>{ 1, 0, 0 });
+	REQUIRE(shapes.column("radius", PT_INTEGER) == nullptr);
+	REQUIRE(shapes.column("unknown", PT_NUMBER) == nullptr);
+
+	const auto reflectance = compiled.table(OT_BSDF).column("reflectance", PT_COLOR);
+	REQUIRE(reflectance != nullptr);
+	REQUIRE(reflectance->colors[0] == compiled.table(OT_BSDF).objects[0]->property("reflectance").getColor());
+
+	// Rare keys get no column
+	const auto common = scene.compile(Number(0.5));
+	REQUIRE(common.table(OT_SHAPE).columns.empty());
+	REQUIRE(common.table(OT_BSDF).column("reflectance", PT_COLOR) != nullptr);
+
+	// References are indices, the shared bsdf has a single row
+	REQUIRE(shapes.childOffsets.size() == 4);
+	const auto& first = shapes.children[shapes.childOffsets[0]];
+	REQUIRE(first.type == OT_BSDF);
+	REQUIRE(first.index == 0);
+	REQUIRE(first.slot == -1);
+
+	const uint32_t begin = shapes.childOffsets[1];
+	const uint32_t end	 = shapes.childOffsets[2];
+	REQUIRE(end - begin == 2);
+	REQUIRE(shapes.children[begin].type == OT_EMITTER);
+	REQUIRE(shapes.children[begin + 1].index == 0);
+	REQUIRE(compiled.slots[shapes.children[begin + 1].slot] == "bsdf");
+	REQUIRE(compiled.object(shapes.children[begin + 1]) == scene.anonymousChildren()[0].get());
+}
+
+TEST_CASE("ID Index", "[integrity]")
+{
+	const char* str = "<scene version='0.6'>"
+					  "<bsdf type='diffuse' id='white'/>"
+					  "<alias id='white' as='default'/>"
+					  "<shape type='sphere' id='ball'><ref id='white'/></shape>"
+					  "<shape type='cube'><bsdf type='conductor' id='metal'/></shape>"
+					  "<shape type='cube'><ref name='bsdf' id='metal'/></shape>"
+					  "<shape type='cube'><ref name='bsdf' id='metal'/></shape>"
+					  "</scene>";
+
+	SceneLoader loader;
+	loader.enableDeduplication();
+	const auto scene = loader.loadFromString(str);
+
+	REQUIRE(scene.ids().size() == 4);
+	REQUIRE(scene.findByID("white") == scene.anonymousChildren()[0]);
+	REQUIRE(scene.findByID("default") == scene.anonymousChildren()[0]);
+	REQUIRE(scene.findByID("unknown") == nullptr);
+
+	REQUIRE(scene.referrers("white").size() == 1);
+	REQUIRE(scene.referrers("white")[0] == scene.findByID("ball").get());
+	REQUIRE(scene.referrers("ball").empty()); // The scene is not listed
+	REQUIRE(scene.referrers("unknown").empty());
+
+	// The two identical cubes were merged, the dropped one is not listed anymore
+	const auto& metal = scene.referrers("metal");
+	REQUIRE(metal.size() == 2);
+	REQUIRE(metal[0] == scene.anonymousChildren()[2].get());
+	REQUIRE(metal[1] == scene.anonymousChildren()[3].get());
+	REQUIRE(scene.anonymousChildren()[3] == scene.anonymousChildren()[4]);
+
+	// References of a parent interleaved with the ones of its children list each referrer once
+	const auto interleaved = loader.loadFromString("<scene version='0.6'>"
+												   "<texture type='bitmap' id='T'/>"
+												   "<shape type='sphere'><ref name='a' id='T'/>"
+												   "<bsdf type='diffuse'><ref name='reflectance' id='T'/></bsdf>"
+												   "<ref name='b' id='T'/></shape>"
+												   "</scene>");
+	const auto& texture = interleaved.referrers("T");
+	REQUIRE(texture.size() == 2);
+	REQUIRE(texture[0] == interleaved.anonymousChildren()[1].get());
+	REQUIRE(texture[1] == interleaved.anonymousChildren()[1]->anonymousChildren()[0].get());
+}
+
+TEST_CASE("Scene Query", "[integrity]")
+{
+	const char* str = "<scene version='0.6'>"
+					  "<texture type='bitmap' id='tex'><string name='filename' value='a.png'/></texture>"
+					  "<shape type='obj'><string name='filename' value='a.obj'/><emitter type='area'/></shape>"
+					  "<shape type='obj'><string name='filename' value='b.obj'/><bsdf type='diffuse'><ref name='reflectance' id='tex'/></bsdf></shape>"
+					  "<shape type='sphere'/>"
+					  "<emitter type='point'/>"
+					  "</scene>";
+
+	SceneLoader loader;
+	const auto scene = loader.loadFromString(str);
+
+	REQUIRE(scene.objectsOfType(OT_SHAPE).size() == 3);
+	REQUIRE(scene.objectsOfType(OT_EMITTER).size() == 2);
+	REQUIRE(scene.objectsOfType(OT_TEXTURE).size() == 1); // Referenced objects are listed once
+	REQUIRE(scene.objectsOfType(OT_SCENE).empty());
+
+	const auto& objs = scene.objectsOfType(OT_SHAPE, "obj");
+	REQUIRE(objs.size() == 2);
+	REQUIRE(objs[0]->property("filename").getString() == "a.obj");
+	REQUIRE(objs[1]->property("filename").getString() == "b.obj");
+	REQUIRE(scene.objectsOfType(OT_BSDF, "obj").empty());
+
+	REQUIRE(scene.objectsWithProperty("filename").size() == 3);
+	REQUIRE(scene.objectsWithProperty("filename")[0]->type() == OT_TEXTURE);
+	REQUIRE(scene.objectsWithProperty("radius").empty());
+}
+
+TEST_CASE("Traversal", "[integrity]")
+{
+	const char* str = "<scene version='0.6'>"
+					  "<bsdf type='diffuse' id='white'/>"
+					  "<shape type='sphere'><ref name='bsdf' id='white'/><emitter type='area'/><medium name='interior' type='homogeneous'/></shape>"
+					  "<shape type='cube'><ref id='white'/></shape>"
+					  "</scene>";
+
+	SceneLoader loader;
+	auto scene = loader.loadFromString(str);
+
+	const auto& sphere = scene.anonymousChildren()[1];
+	REQUIRE(sphere->children().size() == 3);
+	REQUIRE(sphere->children()[0].name == "bsdf");
+	REQUIRE(sphere->children()[1].name.empty());
+	REQUIRE(sphere->children()[1].object->type() == OT_EMITTER);
+	REQUIRE(sphere->children()[2].name == "interior");
+	REQUIRE(sphere->children()[0].object->parent() == nullptr); // Not enabled
+
+	std::vector<std::string> dfs;
+	scene.visitDepthFirst([&](const ObjectVisit& visit) {
+		dfs.push_back(visit.object->pluginType() + ":" + visit.slot);
+		if (visit.depth == 0)
+			REQUIRE(visit.parent == nullptr);
+		return true;
+	});
+	REQUIRE(dfs == std::vector<std::string>{ ":", "diffuse:", "sphere:", "diffuse:bsdf", "area:", "homogeneous:interior", "cube:", "diffuse:" });
+
+	std::vector<std::string> bfs;
+	const auto collect = [&](const ObjectVisit& visit) {
+		bfs.push_back(visit.object->pluginType());
+		return visit.object->pluginType() != "sphere"; // Skip children of the sphere
+	};
+	std::vector<ObjectVisit> queue;
+	scene.visitBreadthFirst(collect, &queue);
+	REQUIRE(bfs == std::vector<std::string>{ "", "diffuse", "sphere", "cube", "diffuse" });
+
+	loader.enableParentLinks();
+	scene = loader.loadFromString(str);
+	REQUIRE(scene.anonymousChildren()[0]->parent() == nullptr); // Top-level
+	REQUIRE(scene.anonymousChildren()[1]->parent() == nullptr);
+	const auto& emitter = scene.anonymousChildren()[1]->children()[1].object;
+	REQUIRE(emitter->parent() == scene.anonymousChildren()[1].get());
+}
+
+TEST_CASE("Scene Handler", "[integrity]")
+{
+	struct Recorder : public SceneHandler {
+		std::vector<std::string> events;
+
+		void onObjectBegin(ObjectType, const std::string& pluginType, const std::string& id, const std::string& name) override
+		{
+			events.push_back("begin " + pluginType + " " + id + " " + name);
+		}
+		void onProperty(const std::string& name, const Property& property) override
+		{
+			events.push_back("property " + name + " " + std::to_string(property.getInteger()));
+		}
+		void onReference(const std::string& id, const std::string& name) override
+		{
+			events.push_back("ref " + id + " " + name);
+		}
+		void onObjectEnd(ObjectType) override { events.push_back("end"); }
+	};
+
+	const char* str = "<scene version='0.6'>"
+					  "<default name='count' value='4'/>"
+					  "<bsdf type='diffuse' id='white'/>"
+					  "<shape type='sphere'><integer name='maxDepth' value='$count'/><ref name='bsdf' id='white'/></shape>"
+					  "</scene>";
+
+	Recorder recorder;
+	SceneLoader loader;
+	loader.parseFromString(str, recorder);
+
+	const std::vector<std::string> expected = {
+		"begin   ",
+		"begin diffuse white ",
+		"end",
+		"begin sphere  ",
+		"property max_depth 4",
+		"ref white bsdf",
+		"end",
+		"end"
+	};
+	REQUIRE(recorder.events == expected);
+
+	REQUIRE_THROWS(loader.parseFromString("<scene version='0.6'><unknown/></scene>", recorder));
+}
+
+TEST_CASE("Value Pool", "[integrity]")
+{
+	SceneLoader loader;
+	loader.enableValuePooling();
+	loader.enableTransformInverseCaching();
+	const char* xml = "<scene version='0.6'>"
+					  "<shape type='sphere'><spectrum name='albedo' value='400:0.5, 700:0.25'/><transform name='to_world'><scale value='2'/></transform></shape>"
+					  "<shape type='sphere'><spectrum name='albedo' value='400:0.5, 700:0.25'/><transform name='to_world'><scale value='2'/></transform></shape>"
+					  "<shape type='cube'><spectrum name='albedo' value='400:0.5, 700:0.5'/><transform name='to_world'><scale value='2'/></transform></shape>"
+					  "</scene>";
+	auto scene = loader.loadFromString(xml);
+
+	const auto& report = scene.poolReport();
+	REQUIRE(report.spectraVisited == 3);
+	REQUIRE(report.spectraShared == 1);
+	REQUIRE(report.uniqueSpectra() == 2);
+	REQUIRE(report.transformsVisited == 3);
+	REQUIRE(report.transformsShared == 2);
+	REQUIRE(report.transformHitRate() == Catch::Approx(2.0 / 3.0));
+
+	// Without cached inverses no transform is shared
+	SceneLoader uncachedLoader;
+	uncachedLoader.enableValuePooling();
+	const auto uncached = uncachedLoader.loadFromString(xml);
+	REQUIRE(uncached.poolReport().transformsVisited == 3);
+	REQUIRE(uncached.poolReport().transformsShared == 0);
+	REQUIRE(uncached.poolReport().spectraShared == 1);
+
+	const auto& shapes = scene.objectsOfType(OT_SHAPE);
+	REQUIRE(&shapes[0]->property("albedo").getSpectrum() == &shapes[1]->property("albedo").getSpectrum());
+	REQUIRE(&shapes[0]->property("albedo").getSpectrum() != &shapes[2]->property("albedo").getSpectrum());
+	REQUIRE(shapes[1]->property("albedo").getSpectrum().weights()[1] == Number(0.25));
+
+	// Values added later on are pooled into the existing pool
+	shapes[2]->setProperty("albedo", shapes[0]->property("albedo"));
+	shapes[2]->setProperty("tint", Property::fromSpectrum(Spectrum({ 400, 700 }, { 0.5f, 0.25f })));
+	scene.poolValues();
+	REQUIRE(report.spectraVisited == 4);
+	REQUIRE(report.spectraShared == 3);
+	REQUIRE(&shapes[2]->property("tint").getSpectrum() == &shapes[0]->property("albedo").getSpectrum());
+
+	// Objects added later on are not part of the load indices but pooled as well
+	auto bsdf = std::make_shared<Object>(OT_BSDF, "diffuse", "");
+	bsdf->setProperty("reflectance", Property::fromSpectrum(Spectrum({ 400, 700 }, { 0.5f, 0.25f })));
+	shapes[1]->addNamedChild("bsdf", bsdf);
+	scene.poolValues();
+	REQUIRE(&bsdf->property("reflectance").getSpectrum() == &shapes[0]->property("albedo").getSpectrum());
+
+	// Lazy spectra are pooled once decoded
+	loader.enableLazyProperties();
+	auto lazy = loader.loadFromString(xml);
+	REQUIRE(lazy.poolReport().spectraVisited == 0);
+
+	const auto& lazyShapes = lazy.objectsOfType(OT_SHAPE);
+	for (const Object* shape : lazyShapes)
+		REQUIRE(shape->property("albedo").getSpectrum().weights()[0] == Number(0.5));
+	lazy.poolValues();
+	REQUIRE(lazy.poolReport().spectraVisited == 3);
+	REQUIRE(lazy.poolReport().spectraShared == 1);
+	REQUIRE(&lazyShapes[0]->property("albedo").getSpectrum() == &lazyShapes[1]->property("albedo").getSpectrum());
+	REQUIRE(lazyShapes[1]->property("albedo").getSpectrum().weights()[1] == Number(0.25));
+
+	// Deduplication decodes lazy properties while hashing, before the values are pooled
+	loader.enableDeduplication();
+	auto deduplicated = loader.loadFromString(xml);
+	REQUIRE(deduplicated.poolReport().spectraVisited == 2);
+	REQUIRE(deduplicated.objectsOfType(OT_SHAPE).back()->property("albedo").getSpectrum().weights()[1] == Number(0.5));
+}
+
+TEST_CASE("Object Hash", "[integrity]")
+{
+	const char* xml = "<scene version='0.6'>"
+					  "<shape type='sphere'><float name='radius' value='2'/><bsdf type='diffuse'><rgb name='reflectance' value='1 0 0'/></bsdf></shape>"
+					  "<shape type='sphere'><float name='radius' value='3'/></shape>"
+					  "</scene>";
+
+	SceneLoader loader;
+	auto a = loader.loadFromString(xml);
+	auto b = loader.loadFromString(xml);
+	REQUIRE(a.hash() == b.hash());
+	REQUIRE(a.anonymousChildren()[0]->hash() != a.anonymousChildren()[1]->hash());
+
+	// Changes of a descendant are visible in all ancestors
+	const auto bsdf		  = a.anonymousChildren()[0]->anonymousChildren()[0];
+	const uint64_t before = a.hash();
+	bsdf->setProperty("reflectance", Property::fromColor(Color(0, 1, 0)));
+	REQUIRE(a.hash() != before);
+	REQUIRE(a.anonymousChildren()[1]->hash() == b.anonymousChildren()[1]->hash());
+
+	bsdf->setProperty("reflectance", Property::fromColor(Color(1, 0, 0)));
+	REQUIRE(a.hash() == before);
+
+	(*a.anonymousChildren()[1])["radius"] = Property::fromNumber(4);
+	REQUIRE(a.hash() != before);
+	(*a.anonymousChildren()[1])["radius"] = Property::fromNumber(3);
+	REQUIRE(a.hash() == before);
+
+	a.anonymousChildren()[1]->addNamedChild("bsdf", std::make_shared<Object>(OT_BSDF, "conductor", ""));
+	REQUIRE(a.hash() != before);
+
+	// Null children are never stored, a null named child removes the previous one
+	a.anonymousChildren()[1]->addAnonymousChild(nullptr);
+	a.anonymousChildren()[1]->addNamedChild("bsdf", nullptr);
+	a.anonymousChildren()[1]->addNamedChild("medium", nullptr);
+	REQUIRE(a.anonymousChildren()[1]->children().empty());
+	REQUIRE(a.anonymousChildren()[1]->namedChildren().empty());
+	REQUIRE(a.hash() == before);
+	size_t visits = 0;
+	a.visitDepthFirst([&](const ObjectVisit&) { return ++visits > 0; });
+	REQUIRE(visits == 4);
+	REQUIRE(diff(a, b).empty());
+	REQUIRE(a.compile().roots.size() == 2);
+
+	// Lazy properties hash like decoded ones
+	loader.enableLazyProperties();
+	REQUIRE(loader.loadFromString(xml).hash() == b.hash());
+
+	// Objects shared between scenes invalidate the hashes of both
+	auto texture = std::make_shared<Object>(OT_TEXTURE, "checkerboard", "");
+	a.anonymousChildren()[0]->addNamedChild("texture", texture);
+	b.anonymousChildren()[0]->addNamedChild("texture", texture);
+	const uint64_t sharedA = a.hash();
+	const uint64_t sharedB = b.hash();
+	REQUIRE(sharedB != before);
+	texture->setProperty("scale", Property::fromNumber(2));
+	REQUIRE(a.hash() != sharedA);
+	REQUIRE(b.hash() != sharedB);
+
+	// Copies and moved objects are holders of the children as well, removed holders are not
+	Scene copy			 = a;
+	Scene moved			 = std::move(b);
+	const uint64_t copyA = copy.hash();
+	const uint64_t moveB = moved.hash();
+	texture->setProperty("scale", Property::fromNumber(3));
+	REQUIRE(copy.hash() != copyA);
+	REQUIRE(moved.hash() != moveB);
+
+	a.anonymousChildren()[0]->addNamedChild("texture", nullptr);
+	const uint64_t removed = a.hash();
+	texture->setProperty("scale", Property::fromNumber(4));
+	REQUIRE(a.hash() == removed);
+
+	// Widely shared objects
+	std::vector<std::shared_ptr<Object>> holders;
+	for (int i = 0; i < 40; ++i) {
+		holders.push_back(std::make_shared<Object>(OT_BSDF, "diffuse", ""));
+		holders.back()->addNamedChild("reflectance", texture);
+		holders.back()->addNamedChild("reflectance", texture);
+	}
+	const uint64_t held = holders[7]->hash();
+	holders.resize(20);
+	texture->setProperty("scale", Property::fromNumber(5));
+	REQUIRE(holders[7]->hash() != held);
+	REQUIRE(copy.hash() != copyA);
+}
+
+TEST_CASE("Scene Diff", "[integrity]")
+{
+	const char* xml = "<scene version='0.6'>"
+					  "<shape type='sphere'><float name='radius' value='2'/><bsdf type='diffuse'><rgb name='reflectance' value='1 0 0'/></bsdf></shape>"
+					  "<shape type='sphere' id='ball'><float name='radius' value='3'/></shape>"
+					  "<shape type='sphere'><float name='radius' value='4'/></shape>"
+					  "</scene>";
+
+	SceneLoader loader;
+	const auto a = loader.loadFromString(xml);
+	auto b		 = loader.loadFromString(xml);
+	REQUIRE(diff(a, b).empty());
+
+	// Modified property deep inside
+	const auto bsdf = b.anonymousChildren()[0]->anonymousChildren()[0];
+	bsdf->setProperty("reflectance", Property::fromColor(Color(0, 1, 0)));
+	bsdf->setProperty("alpha", Property::fromNumber(0.5f));
+	auto d = diff(a, b);
+	REQUIRE(d.objects.size() == 1);
+	REQUIRE(d.objects[0].kind == DK_MODIFIED);
+	REQUIRE(d.objects[0].path == "shape[0]/bsdf[0]");
+	REQUIRE(d.objects[0].after == bsdf.get());
+	REQUIRE(d.properties.size() == 2);
+	for (const auto& prop : d.properties) {
+		REQUIRE(prop.path == "shape[0]/bsdf[0]");
+		if (prop.key == "reflectance") {
+			REQUIRE(prop.kind == DK_MODIFIED);
+			REQUIRE(prop.before.getColor() == Color(1, 0, 0));
+			REQUIRE(prop.after.getColor() == Color(0, 1, 0));
+		} else {
+			REQUIRE(prop.key == "alpha");
+			REQUIRE(prop.kind == DK_ADDED);
+			REQUIRE_FALSE(prop.before.isValid());
+		}
+	}
+
+	// Removed property, added named child
+	b.anonymousChildren()[1]->addNamedChild("interior", std::make_shared<Object>(OT_MEDIUM, "homogeneous", ""));
+	d = diff(a, b);
+	REQUIRE(d.objects.size() == 2);
+	REQUIRE(d.objects[1].kind == DK_ADDED);
+	REQUIRE(d.objects[1].path == "shape#ball/interior");
+
+	// Changed layout: anonymous children are matched by id and index
+	auto c = loader.loadFromString(xml);
+	c.addAnonymousChild(std::make_shared<Object>(OT_SHAPE, "cube", "box"));
+	d = diff(a, c);
+	REQUIRE(d.properties.empty());
+	REQUIRE(d.objects.size() == 1);
+	REQUIRE(d.objects[0].kind == DK_ADDED);
+	REQUIRE(d.objects[0].path == "shape#box");
+
+	d = diff(c, a);
+	REQUIRE(d.objects.size() == 1);
+	REQUIRE(d.objects[0].kind == DK_REMOVED);
+	REQUIRE(d.objects[0].before->pluginType() == "cube");
+
+	// Inserting in front shifts the indices, unchanged siblings are still paired by hash
+	auto e = loader.loadFromString("<scene version='0.6'>"
+								   "<shape type='sphere'><float name='radius' value='1'/></shape>"
+								   "<shape type='sphere'><float name='radius' value='2'/><bsdf type='diffuse'><rgb name='reflectance' value='1 0 0'/></bsdf></shape>"
+								   "<shape type='sphere' id='ball'><float name='radius' value='3'/></shape>"
+								   "<shape type='sphere'><float name='radius' value='4'/></shape>"
+								   "</scene>");
+	d = diff(a, e);
+	REQUIRE(d.properties.empty());
+	REQUIRE(d.objects.size() == 1);
+	REQUIRE(d.objects[0].kind == DK_ADDED);
+	REQUIRE(d.objects[0].path == "shape[0]");
+	REQUIRE(d.objects[0].after->property("radius").getNumber() == Number(1));
+
+	// An edit followed by a diff does not walk unrelated subtrees again, which therefore do not add to the time spent
+	auto g		   = loader.loadFromString(xml);
+	auto h		   = loader.loadFromString(xml);
+	const auto add = [](Scene& scene) {
+		for (int i = 0; i < 100000; ++i) {
+			auto texture = std::make_shared<Object>(OT_TEXTURE, "bitmap", "");
+			texture->setProperty("index", Property::fromInteger(i));
+			scene.anonymousChildren()[2]->addNamedChild("texture" + std::to_string(i), texture);
+		}
+	};
+	add(g);
+	add(h);
+	(void)h.hash();
+
+	auto start = std::chrono::steady_clock::now();
+	(void)g.hash();
+	const auto full = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	g.anonymousChildren()[0]->anonymousChildren()[0]->setProperty("alpha", Property::fromNumber(0.5f));
+	d					   = diff(h, g);
+	const auto incremental = std::chrono::steady_clock::now() - start;
+	REQUIRE(d.objects.size() == 1);
+	REQUIRE(d.objects[0].path == "shape[0]/bsdf[0]");
+	REQUIRE(incremental * 10 < full);
+}
+
+TEST_CASE("Change Journal", "[integrity]")
+{
+	const char* xml = "<scene version='0.6'>"
+					  "<shape type='sphere'><float name='radius' value='2'/><bsdf type='diffuse'><rgb name='reflectance' value='1 0 0'/></bsdf></shape>"
+					  "<shape type='sphere'><float name='radius' value='3'/></shape>"
+					  "</scene>";
+
+	SceneLoader loader;
+	auto scene		 = loader.loadFromString(xml);
+	const auto shape = scene.anonymousChildren()[0];
+	const auto bsdf	 = shape->anonymousChildren()[0];
+
+	// Nothing is recorded by default
+	shape->setProperty("radius", Property::fromNumber(4));
+	REQUIRE(scene.journal() == nullptr);
+
+	scene.enableJournal();
+	ChangeJournal* journal = scene.journal();
+	REQUIRE(journal != nullptr);
+	REQUIRE(bsdf->journal() == journal);
+	REQUIRE(journal->empty());
+
+	bsdf->setProperty("reflectance", Property::fromNumber(0.5f));
+	bsdf->setProperty("alpha", Property::fromNumber(0.1f));
+	(*shape)["radius"] = Property::fromNumber(5);
+	bsdf->setProperty("alpha", Property::fromNumber(0.2f));
+
+	REQUIRE(journal->events().size() == 4);
+	REQUIRE(journal->events()[0].kind == CK_PROPERTY);
+	REQUIRE(journal->events()[0].object == bsdf.get());
+	REQUIRE(journal->events()[0].key == "reflectance");
+	REQUIRE(journal->events()[0].oldType == PT_COLOR);
+	REQUIRE(journal->events()[0].newType == PT_NUMBER);
+	REQUIRE(journal->events()[1].oldType == PT_NONE);
+	REQUIRE(journal->events()[2].object == shape.get());
+	REQUIRE(journal->events()[2].oldType == PT_NUMBER);
+	REQUIRE(journal->events()[2].newType == PT_NONE);
+
+	REQUIRE(journal->dirtyObjects().size() == 2);
+	REQUIRE(journal->dirtyObjects()[0] == bsdf.get());
+	REQUIRE(journal->dirtyObjects()[1] == shape.get());
+
+	auto events = journal->drain();
+	REQUIRE(events.size() == 4);
+	REQUIRE(journal->empty());
+	REQUIRE(journal->dirtyObjects().empty());
+
+	// Added children and their descendants are recorded as well
+	auto medium = std::make_shared<Object>(OT_MEDIUM, "homogeneous", "");
+	auto phase	= std::make_shared<Object>(OT_PHASE, "isotropic", "");
+	medium->addNamedChild("phase", phase);
+	scene.anonymousChildren()[1]->addNamedChild("interior", medium);
+	scene.addAnonymousChild(std::make_shared<Object>(OT_SHAPE, "cube", ""));
+	phase->setProperty("g", Property::fromNumber(0.3f));
+	bsdf->setProperty("alpha", Property::fromNumber(0.4f));
+
+	journal->drain(events);
+	REQUIRE(events.size() == 4);
+	REQUIRE(events[0].kind == CK_NAMED_CHILD);
+	REQUIRE(events[0].key == "interior");
+	REQUIRE(events[1].kind == CK_ANONYMOUS_CHILD);
+	REQUIRE(events[1].object == &scene);
+	REQUIRE(events[2].object == phase.get());
+	REQUIRE(events[3].object == bsdf.get());
+
+	// Replaced children and copies do not record anymore
+	phase->setProperty("g", Property::fromNumber(0.5f));
+	REQUIRE(journal->dirtyObjects().size() == 1);
+	medium->addNamedChild("phase", std::make_shared<Object>(OT_PHASE, "hg", ""));
+	REQUIRE(phase->journal() == nullptr);
+	REQUIRE(journal->dirtyObjects().size() == 1);
+	REQUIRE(journal->dirtyObjects()[0] == medium.get());
+	phase->setProperty("g", Property::fromNumber(0.6f));
+	REQUIRE(medium->namedChild("phase")->journal() == journal);
+
+	Object copy = *bsdf;
+	REQUIRE(copy.journal() == nullptr);
+	copy.setProperty("alpha", Property::fromNumber(0.7f));
+	copy = *shape;
+	REQUIRE(copy.journal() == nullptr);
+	REQUIRE(copy.hash() == shape->hash());
+	Scene sceneCopy = scene;
+	REQUIRE(sceneCopy.journal() == nullptr);
+
+	journal->drain(events);
+	REQUIRE(events.size() == 2);
+	REQUIRE(events[1].kind == CK_NAMED_CHILD);
+	REQUIRE(events[1].object == medium.get());
+
+	scene.disableJournal();
+	REQUIRE(scene.journal() == nullptr);
+	REQUIRE(phase->journal() == nullptr);
+	bsdf->setProperty("alpha", Property::fromNumber(0.5f));
+	REQUIRE(bsdf->journal() == nullptr);
+}
@@ -3,6 +3,9 @@
 
 #include "tinyparser-mitsuba.h"
 
+#include <atomic>
+#include <thread>
+
 using namespace TPM_NAMESPACE;
 
 TEST_CASE("Property Construction", "[property]")
@@ -27,4 +30,189 @@ TEST_CASE("Property Access", "[property]")
 	//REQUIRE(Property::fromTransform(Transform()).getTransform() == Transform());
 	REQUIRE(Property::fromString("TEST").getString() == "TEST");
 	//REQUIRE(Property::fromSpectrum(Spectrum()).getSpectrum() == Spectrum());
-}
\ No newline at end of file
+}
+
+TEST_CASE("Property Transform Inverse", "[property]")
+{
+	const Transform M = Transform::fromTranslation(Vector(1, 2, 3)) * Transform::fromScale(Vector(2, 2, 2));
+	const Transform I = M.inverse();
+
+	const auto uncached = Property::fromTransform(M);
+	const auto cached	= Property::fromTransform(M, I);
+	REQUIRE(!uncached.hasCachedTransformInverse());
+	REQUIRE(cached.hasCachedTransformInverse());
+	REQUIRE(uncached.getTransformInverse() == I);
+	REQUIRE(cached.getTransformInverse() == I);
+	REQUIRE(cached.getTransformNormal() == I.transposed());
+	REQUIRE(uncached.getTransformNormal() == I.transposed());
+
+	bool ok = true;
+	(void)Property::fromNumber(1).getTransformInverse(Transform::fromIdentity(), &ok);
+	REQUIRE(!ok);
+
+	SceneLoader loader;
+	loader.enableTransformInverseCaching();
+	auto scene = loader.loadFromString("<scene version='0.6'><transform name='test'><scale value='2, 2, 2'/></transform></scene>");
+	REQUIRE(scene["test"].hasCachedTransformInverse());
+	REQUIRE(scene["test"].getTransformInverse() == Transform::fromScale(Vector(0.5f, 0.5f, 0.5f)));
+
+	// Singular matrices behave the same with and without caching
+	const char* singular = "<scene version='0.6'><transform name='test'><scale value='0, 1, 1'/></transform></scene>";
+	for (bool caching : { false, true }) {
+		loader.enableTransformInverseCaching(caching);
+		scene = loader.loadFromString(singular);
+		REQUIRE(!scene["test"].hasCachedTransformInverse());
+
+		ok = true;
+		REQUIRE(scene["test"].getTransformInverse(M, &ok) == M);
+		REQUIRE(!ok);
+		ok = true;
+		REQUIRE(scene["test"].getTransformNormal(M, &ok) == M);
+		REQUIRE(!ok);
+	}
+}
+
+TEST_CASE("Property Transform Decomposition", "[property]")
+{
+	SceneLoader loader;
+	auto plain = loader.loadFromString("<scene version='0.6'><transform name='test'><scale value='2, 2, 2'/></transform></scene>");
+	REQUIRE(plain["test"].getTransformDecomposition() == nullptr);
+
+	loader.enableTransformDecomposition();
+	auto scene = loader.loadFromString("<scene version='0.6'>"
+									   "<transform name='trs'><scale value='2, 2, 2'/><rotate y='1' angle='45'/><translate x='1' y='2' z='3'/></transform>"
+									   "<transform name='shear'><rotate z='1' angle='45'/><scale value='2, 1, 1'/></transform>"
+									   "<transform name='lookat'><scale value='1, 2, 3'/><lookat origin='1, 0, 0' target='0, 0, 0' up='0, 1, 0'/></transform>"
+									   "</scene>");
+
+	const auto trs = scene["trs"].getTransformDecomposition();
+	REQUIRE(trs != nullptr);
+	REQUIRE(trs->operations.size() == 3);
+	REQUIRE(trs->operations[0].type == TOT_SCALE);
+	REQUIRE(trs->operations[1].type == TOT_ROTATE);
+	REQUIRE(trs->operations[1].angle == 45);
+	REQUIRE(trs->operations[2].type == TOT_TRANSLATE);
+	REQUIRE(trs->isTRS);
+
+	const auto shear = scene["shear"].getTransformDecomposition();
+	REQUIRE(shear != nullptr);
+	REQUIRE(shear->operations.size() == 2);
+	REQUIRE(!shear->isTRS);
+
+	const auto lookat = scene["lookat"].getTransformDecomposition();
+	REQUIRE(lookat != nullptr);
+	REQUIRE(lookat->isTRS);
+
+	for (const auto name : { "trs", "lookat" }) {
+		const auto M = scene[name].getTransform();
+		const auto R = scene[name].getTransformDecomposition()->trs.toTransform();
+		for (int i = 0; i < 4; ++i) {
+			for (int j = 0; j < 4; ++j)
+				REQUIRE(R(i, j) == Catch::Approx(M(i, j)).margin(1e-5));
+		}
+	}
+}
+
+struct BoundSphere {
+	Number radius = 1;
+	Vector center = Vector(0, 0, 0);
+	std::string name;
+	Integer samples = 0;
+};
+
+TEST_CASE("Plugin Binding", "[property]")
+{
+	const std::vector<FieldBinding> fields = {
+		TPM_BIND_FIELD(BoundSphere, "radius", radius),
+		TPM_BIND_FIELD(BoundSphere, "center", center),
+		TPM_BIND_FIELD(BoundSphere, "name", name),
+		TPM_BIND_FIELD(BoundSphere, "samples", samples)
+	};
+	REQUIRE(fields[0].type == PT_NUMBER);
+	REQUIRE(fields[1].type == PT_VECTOR);
+
+	SceneLoader loader;
+	loader.bindPlugin<BoundSphere>(OT_SHAPE, "sphere", fields);
+	auto scene = loader.loadFromString("<scene version='0.6'>"
+									   "<shape type='sphere'><float name='radius' value='2'/><point name='center' x='1' y='2' z='3'/>"
+									   "<string name='name' value='ball'/><float name='samples' value='4'/><boolean name='flip' value='true'/></shape>"
+									   "<shape type='cube'><float name='radius' value='2'/></shape>"
+									   "</scene>");
+
+	const auto& sphere = scene.anonymousChildren()[0];
+	const auto data	   = sphere->boundData<BoundSphere>();
+	REQUIRE(data != nullptr);
+	REQUIRE(data->radius == 2);
+	REQUIRE(data->center == Vector(1, 2, 3));
+	REQUIRE(data->name == "ball");
+	REQUIRE(data->samples == 0); // Type mismatch, kept as property
+	REQUIRE(sphere->properties().size() == 2);
+	REQUIRE(sphere->property("samples").getNumber() == 4);
+	REQUIRE(sphere->property("flip").getBool());
+	REQUIRE(!sphere->property("radius").isValid());
+	REQUIRE(sphere->boundData<Vector>() == nullptr);
+
+	const auto& cube = scene.anonymousChildren()[1];
+	REQUIRE(!cube->hasBoundData());
+	REQUIRE(cube->property("radius").getNumber() == 2);
+
+	// Custom factory
+	int created = 0;
+	loader.bindPlugin<BoundSphere>(OT_SHAPE, "cube", fields, [&]() { ++created; return new BoundSphere(); });
+	scene = loader.loadFromString("<scene version='0.6'><shape type='cube'><float name='radius' value='3'/></shape></scene>");
+	REQUIRE(created == 1);
+	REQUIRE(scene.anonymousChildren()[0]->boundData<BoundSphere>()->radius == 3);
+
+	loader.unbindPlugin(OT_SHAPE, "cube");
+	REQUIRE(loader.pluginBinding(OT_SHAPE, "cube") == nullptr);
+	REQUIRE(loader.pluginBinding(OT_SHAPE, "sphere") != nullptr);
+}
+
+TEST_CASE("Lazy Properties", "[property]")
+{
+	SceneLoader loader;
+	loader.enableLazyProperties();
+	loader.addArgument("r", "2");
+	auto scene = loader.loadFromString("<scene version='0.6'>"
+									   "<shape type='sphere'><float name='radius' value='$r'/><default name='s' value='5'/>"
+									   "<spectrum name='tint' value='400:$s, 500:$r'/><float name='broken' value='abc'/>"
+									   "<spectrum name='missing' filename='tpm_missing.spd'/>"
+									   "<transform name='to_world'><translate x='1'/></transform></shape>"
+									   "</scene>");
+
+	// Small values are decoded immediately and invalid ones are skipped as usual
+	const auto& sphere = scene.anonymousChildren()[0];
+	REQUIRE(sphere->properties().size() == 4);
+	REQUIRE(sphere->property("radius").isDecoded());
+	REQUIRE(sphere->property("radius").getNumber() == 2);
+	REQUIRE(sphere->property("tint").type() == PT_SPECTRUM);
+	REQUIRE(!sphere->property("tint").isDecoded());
+
+	// Copies share the decoded value
+	const Property tint = sphere->property("tint");
+	REQUIRE(tint.getSpectrum().weights() == std::vector<Number>{ 5, 2 });
+	REQUIRE(tint.isDecoded());
+	REQUIRE(sphere->property("tint").isDecoded());
+	REQUIRE(sphere->property("to_world").getTransform() == Transform::fromTranslation(Vector(1, 0, 0)));
+
+	// Invalid values are only detected on access and getters do not throw
+	bool ok = true;
+	REQUIRE(sphere->property("missing").type() == PT_SPECTRUM);
+	REQUIRE(sphere->property("missing").getSpectrum(Spectrum(3), &ok).uniformValue() == 3);
+	REQUIRE(!ok);
+
+	// Concurrent first access
+	scene = loader.loadFromString("<scene version='0.6'><bsdf type='diffuse'><spectrum name='reflectance' value='0.5'/></bsdf></scene>");
+	const Property reflectance = scene.anonymousChildren()[0]->property("reflectance");
+	std::vector<std::thread> threads;
+	std::atomic<int> matches(0);
+	for (int i = 0; i < 4; ++i) {
+		threads.emplace_back([&]() {
+			if (reflectance.getSpectrum().uniformValue() == 0.5f)
+				++matches;
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	REQUIRE(matches == 4);
+}
@@ -0,0 +1,182 @@
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch_all.hpp>
+
+#include "tinyparser-mitsuba.h"
+
+#include <limits>
+#include <vector>
+
+using namespace TPM_NAMESPACE;
+
+TEST_CASE("Spectrum Evaluation", "[spectrum]")
+{
+	const Spectrum spec({ 400, 500, 600 }, { 1, 3, 2 });
+	REQUIRE(spec.evaluate(400) == Catch::Approx(1));
+	REQUIRE(spec.evaluate(450) == Catch::Approx(2));
+	REQUIRE(spec.evaluate(550) == Catch::Approx(2.5));
+	REQUIRE(spec.evaluate(600) == Catch::Approx(2));
+	REQUIRE(spec.evaluate(399) == 0);
+	REQUIRE(spec.evaluate(601) == 0);
+	REQUIRE(Spectrum(Number(4)).evaluate(1000) == 4);
+
+	// Unordered queries give the same result
+	const Number lambdas[] = { 550, 410, 599, 450, 700 };
+	Number out[5];
+	spec.evaluate(lambdas, out, 5);
+	for (int i = 0; i < 5; ++i)
+		REQUIRE(out[i] == spec.evaluate(lambdas[i]));
+
+	// Sorted queries jumping over many segments
+	std::vector<Number> wvls, weights;
+	for (int i = 0; i <= 100; ++i) {
+		wvls.push_back(Number(400 + 3 * i));
+		weights.push_back(Number(i % 7));
+	}
+	const Spectrum dense(wvls, weights);
+	const Number sorted[] = { 401, 402, 410, 500, 501.5f, 650, 699, 700 };
+	Number sortedOut[8];
+	dense.evaluate(sorted, sortedOut, 8);
+	for (int i = 0; i < 8; ++i)
+		REQUIRE(sortedOut[i] == dense.evaluate(sorted[i]));
+}
+
+TEST_CASE("Spectrum Resampling", "[spectrum]")
+{
+	SpectrumResampler resampler(400, 600, 50);
+	REQUIRE(resampler.sampleCount() == 5);
+	REQUIRE(resampler.wavelength(4) == 600);
+
+	const Spectrum spec({ 420, 520.5f, 580 }, { 1, 2, 4 });
+	const Number* samples = resampler.resample(spec);
+	for (size_t i = 0; i < resampler.sampleCount(); ++i)
+		REQUIRE(samples[i] == Catch::Approx(spec.evaluate(resampler.wavelength(i))).margin(1e-5));
+	REQUIRE(samples[0] == 0);
+	REQUIRE(samples[4] == 0);
+
+	// Cached per distinct spectrum
+	REQUIRE(resampler.resample(Spectrum({ 420, 520.5f, 580 }, { 1, 2, 4 })) == samples);
+	REQUIRE(resampler.cacheSize() == 1);
+
+	const Number uniform = resampler.resample(Spectrum(Number(2)))[3];
+	REQUIRE(uniform == 2);
+	REQUIRE(resampler.cacheSize() == 2);
+
+	// Evaluation on the grid
+	const Number lambdas[] = { 450, 475, 300, 600, 700 };
+	Number out[5];
+	resampler.evaluate(spec, lambdas, out, 5);
+	REQUIRE(out[0] == Catch::Approx(samples[1]));
+	REQUIRE(out[1] == Catch::Approx((samples[1] + samples[2]) / 2));
+	REQUIRE(out[2] == 0);
+	REQUIRE(out[3] == Catch::Approx(samples[4]));
+	REQUIRE(out[4] == 0);
+
+	resampler.clearCache();
+	REQUIRE(resampler.cacheSize() == 0);
+}
+
+TEST_CASE("Scene Spectrum Resampling", "[spectrum]")
+{
+	SceneLoader loader;
+	auto scene = loader.loadFromString("<scene version='0.6'>"
+									   "<bsdf type='diffuse'><spectrum name='reflectance' value='400:0.1, 700:0.9'/></bsdf>"
+									   "<bsdf type='diffuse'><spectrum name='reflectance' value='400:0.1, 700:0.9'/></bsdf>"
+									   "<emitter type='area'><spectrum name='radiance' value='5'/></emitter>"
+									   "<spectrum name='ambient' value='380:1, 780:1'/>"
+									   "</scene>");
+
+	SpectrumResampler resampler;
+	REQUIRE(resampler.sampleCount() == 95);
+	REQUIRE(resampler.resample(scene, 2) == 3);
+	REQUIRE(resampler.cacheSize() == 3);
+
+	const auto& bsdfs = scene.objectsOfType(OT_BSDF);
+	const Number* a	  = resampler.resample(bsdfs[0]->property("reflectance").getSpectrum());
+	const Number* b	  = resampler.resample(bsdfs[1]->property("reflectance").getSpectrum());
+	REQUIRE(a == b);
+	REQUIRE(resampler.cacheSize() == 3);
+	REQUIRE(a[(550 - 360) / 5] == Catch::Approx(0.5));
+
+	// Objects added after loading are not part of the load indices but still resampled
+	auto added = std::make_shared<Object>(OT_BSDF, "diffuse", "");
+	added->setProperty("reflectance", Property::fromSpectrum(Spectrum({ 400, 700 }, { 0.2f, 0.4f })));
+	bsdfs[0]->addNamedChild("nested", added);
+	REQUIRE(resampler.resample(scene) == 4);
+	REQUIRE(resampler.cacheSize() == 4);
+}
+
+TEST_CASE("Color Conversion", "[spectrum]")
+{
+	ColorConverter rgb;
+	ColorConverter xyz(CS_XYZ);
+
+	REQUIRE(rgb.convert(Color(1, 0.5f, 0)) == Color(1, 0.5f, 0));
+	const Color white = xyz.convert(Color(1, 1, 1));
+	REQUIRE(white.r == Catch::Approx(0.9505).margin(1e-3));
+	REQUIRE(white.g == Catch::Approx(1).margin(1e-3));
+	REQUIRE(white.b == Catch::Approx(1.089).margin(1e-3));
+
+	// Uniform spectra are grey values, others are integrated and adapted to the same white
+	REQUIRE(rgb.convert(Spectrum(Number(0.5))) == Color(0.5f, 0.5f, 0.5f));
+	const Color flat	= xyz.convert(Spectrum({ 360, 830 }, { 2, 2 }));
+	const Color uniform = xyz.convert(Spectrum(Number(2)));
+	REQUIRE(flat.r == Catch::Approx(uniform.r).margin(1e-4));
+	REQUIRE(flat.g == Catch::Approx(uniform.g).margin(1e-4));
+	REQUIRE(flat.b == Catch::Approx(uniform.b).margin(1e-4));
+	REQUIRE(xyz.cacheSize() == 1);
+
+	const Color flatRGB = rgb.convert(Spectrum({ 360, 830 }, { 0.5f, 0.5f }));
+	REQUIRE(flatRGB.r == Catch::Approx(0.5).margin(1e-4));
+	REQUIRE(flatRGB.g == Catch::Approx(0.5).margin(1e-4));
+	REQUIRE(flatRGB.b == Catch::Approx(0.5).margin(1e-4));
+
+	// Close to the equal energy white point, hence about grey
+	const Color grey = rgb.convert(Blackbody(5455, 1));
+	REQUIRE(grey.r / grey.g == Catch::Approx(1).margin(0.1));
+	REQUIRE(grey.b / grey.g == Catch::Approx(1).margin(0.1));
+
+	// Absolute spectral radiance like Mitsuba, scaled linearly
+	REQUIRE(xyz.convert(Blackbody(5000, 1)).g == Catch::Approx(12580).epsilon(0.01));
+	REQUIRE(xyz.convert(Blackbody(3000, 2)).g == Catch::Approx(2 * xyz.convert(Blackbody(3000, 1)).g));
+	REQUIRE_THROWS_AS(rgb.convert(Blackbody(std::numeric_limits<Number>::quiet_NaN(), 1)), std::runtime_error);
+	REQUIRE_THROWS_AS(rgb.convert(Blackbody(std::numeric_limits<Number>::infinity(), 1)), std::runtime_error);
+
+	const Number temperatures[] = { 1500, 3000, 6504, 3000, 12000 };
+	Color batch[5] = { Color(0, 0, 0), Color(0, 0, 0), Color(0, 0, 0), Color(0, 0, 0), Color(0, 0, 0) };
+	rgb.convertBlackbodies(temperatures, batch, 5);
+	REQUIRE(batch[0].r > batch[0].b);
+	REQUIRE(batch[4].b > batch[4].r);
+	REQUIRE(batch[1] == batch[3]);
+	for (int i = 0; i < 5; ++i)
+		REQUIRE(batch[i] == rgb.convert(Blackbody(temperatures[i], 1)));
+
+	rgb.clearCache();
+	REQUIRE(rgb.cacheSize() == 0);
+}
+
+TEST_CASE("Scene Color Conversion", "[spectrum]")
+{
+	SceneLoader loader;
+	auto scene = loader.loadFromString("<scene version='0.6'>"
+									   "<bsdf type='diffuse'><spectrum name='reflectance' value='400:0.1, 700:0.9'/><float name='alpha' value='0.1'/></bsdf>"
+									   "<emitter type='area'><blackbody name='radiance' temperature='4000' scale='3'/></emitter>"
+									   "<emitter type='point'><rgb name='intensity' value='1 1 1'/></emitter>"
+									   "</scene>");
+
+	// Objects added after loading are converted as well
+	auto texture = std::make_shared<Object>(OT_TEXTURE, "checkerboard", "");
+	texture->setProperty("color0", Property::fromSpectrum(Spectrum({ 400, 700 }, { 0.2f, 0.4f })));
+	scene.objectsOfType(OT_BSDF)[0]->addNamedChild("diffuse_reflectance", texture);
+
+	ColorConverter converter(CS_XYZ);
+	REQUIRE(converter.convert(scene, 2) == 4);
+	REQUIRE(texture->property("color0").type() == PT_COLOR);
+
+	const auto bsdf = scene.objectsOfType(OT_BSDF)[0];
+	REQUIRE(bsdf->property("reflectance").type() == PT_COLOR);
+	REQUIRE(bsdf->property("alpha").type() == PT_NUMBER);
+
+	const auto& emitters = scene.objectsOfType(OT_EMITTER);
+	REQUIRE(emitters[0]->property("radiance").getColor().g == Catch::Approx(3 * converter.convert(Blackbody(4000, 1)).g));
+	REQUIRE(emitters[1]->property("intensity").getColor().g == Catch::Approx(1).margin(1e-3));
+}
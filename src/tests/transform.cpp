@@ -1,6 +1,8 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch_all.hpp>
 
+#include <vector>
+
 #include "tinyparser-mitsuba.h"
 
 using namespace TPM_NAMESPACE;
@@ -136,4 +138,285 @@ TEST_CASE("Simple Transform", "[transform]")
 	REQUIRE(M(3, 1) == 0);
 	REQUIRE(M(3, 2) == 0);
 	REQUIRE(M(3, 3) == 1);
-}
\ No newline at end of file
+}
+
+static Transform referenceMultiply(const Transform& a, const Transform& b)
+{
+	Transform result;
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			Number sum = 0;
+			for (int k = 0; k < 4; ++k)
+				sum += a(i, k) * b(k, j);
+			result(i, j) = sum;
+		}
+	}
+	return result;
+}
+
+TEST_CASE("Composition", "[transform]")
+{
+	const Transform A = Transform::fromTranslation(Vector(1, -2, 3)) * Transform::fromRotation(Vector(1, 1, 0), 30);
+	const Transform B = Transform::fromScale(Vector(2, 0.5f, 4)) * Transform::fromLookAt(Vector(1, 2, 3), Vector(0, 0, 0), Vector(0, 0, 1));
+	const Transform P(Transform::Array{ { 1, 2, 3, 4,
+										  5, 6, 7, 8,
+										  9, 10, 11, 12,
+										  0.5f, 0.25f, 0.125f, 2 } });
+
+	REQUIRE(A.isAffine());
+	REQUIRE(B.isAffine());
+	REQUIRE(!P.isAffine());
+
+	const Transform pairs[][2] = { { A, B }, { B, A }, { A, P }, { P, B }, { P, P } };
+	for (const auto& pair : pairs) {
+		const Transform M = pair[0] * pair[1];
+		const Transform R = referenceMultiply(pair[0], pair[1]);
+		for (int i = 0; i < 16; ++i)
+			REQUIRE(M.matrix[i] == Catch::Approx(R.matrix[i]).margin(1e-6));
+	}
+
+	const Transform M = A * B;
+	REQUIRE(M(3, 0) == 0);
+	REQUIRE(M(3, 1) == 0);
+	REQUIRE(M(3, 2) == 0);
+	REQUIRE(M(3, 3) == 1);
+}
+
+TEST_CASE("Inverse", "[transform]")
+{
+	const Transform A = Transform::fromTranslation(Vector(1, -2, 3)) * Transform::fromRotation(Vector(1, 1, 0), 30) * Transform::fromScale(Vector(2, 3, 4));
+	const Transform P(Transform::Array{ { 2, 0, 0, 1,
+										  0, 3, 0, 2,
+										  0, 0, 4, 3,
+										  0, 0, 1, 1 } });
+
+	for (const auto& M : { A, P }) {
+		bool ok		  = false;
+		const auto I  = M.inverse(&ok);
+		const auto MI = M * I;
+		REQUIRE(ok);
+		for (int i = 0; i < 4; ++i) {
+			for (int j = 0; j < 4; ++j)
+				REQUIRE(MI(i, j) == Catch::Approx(i == j ? 1 : 0).margin(1e-5));
+		}
+	}
+
+	bool ok = true;
+	REQUIRE(Transform::fromScale(Vector(1, 0, 1)).inverse(&ok) == Transform::fromIdentity());
+	REQUIRE(!ok);
+}
+
+TEST_CASE("Quaternion", "[transform]")
+{
+	const auto q = Quaternion::fromRotation(Vector(1, 2, 3), 60);
+	const auto M = Transform::fromRotation(Vector(1, 2, 3), 60);
+	const auto R = q.toTransform();
+	const auto B = Quaternion::fromMatrix(M).toTransform();
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			REQUIRE(R(i, j) == Catch::Approx(M(i, j)).margin(1e-5));
+			REQUIRE(B(i, j) == Catch::Approx(M(i, j)).margin(1e-5));
+		}
+	}
+
+	const auto v = q.rotate(Vector(1, 0, 0));
+	REQUIRE(v.x == Catch::Approx(M(0, 0)).margin(1e-5));
+	REQUIRE(v.y == Catch::Approx(M(1, 0)).margin(1e-5));
+	REQUIRE(v.z == Catch::Approx(M(2, 0)).margin(1e-5));
+
+	const auto half = Quaternion::slerp(Quaternion::fromIdentity(), Quaternion::fromRotation(Vector(0, 0, 1), 90), 0.5f);
+	const auto H	= half.toTransform();
+	const auto E	= Transform::fromRotation(Vector(0, 0, 1), 45);
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j)
+			REQUIRE(H(i, j) == Catch::Approx(E(i, j)).margin(1e-5));
+	}
+}
+
+TEST_CASE("TRS Interpolation", "[transform]")
+{
+	TransformTRS a;
+	TransformTRS b;
+	b.translation = Vector(2, 4, 6);
+	b.scale		  = Vector(3, 3, 3);
+	b.rotation	  = Quaternion::fromRotation(Vector(0, 1, 0), 90);
+
+	const auto c = TransformTRS::interpolate(a, b, 0.5f);
+	REQUIRE(c.translation.x == Catch::Approx(1));
+	REQUIRE(c.translation.y == Catch::Approx(2));
+	REQUIRE(c.translation.z == Catch::Approx(3));
+	REQUIRE(c.scale.x == Catch::Approx(2));
+
+	const auto M = c.toTransform();
+	const auto E = Transform::fromTranslation(Vector(1, 2, 3)) * Transform::fromRotation(Vector(0, 1, 0), 45) * Transform::fromScale(Vector(2, 2, 2));
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j)
+			REQUIRE(M(i, j) == Catch::Approx(E(i, j)).margin(1e-5));
+	}
+}
+
+static void naiveTransformPoints(const Transform& M, const float* in, float* out, size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		const float x  = in[3 * i + 0];
+		const float y  = in[3 * i + 1];
+		const float z  = in[3 * i + 2];
+		out[3 * i + 0] = M(0, 0) * x + M(0, 1) * y + M(0, 2) * z + M(0, 3);
+		out[3 * i + 1] = M(1, 0) * x + M(1, 1) * y + M(1, 2) * z + M(1, 3);
+		out[3 * i + 2] = M(2, 0) * x + M(2, 1) * y + M(2, 2) * z + M(2, 3);
+	}
+}
+
+static std::vector<float> makeTriplets(size_t count)
+{
+	std::vector<float> data(3 * count);
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = float(i % 17) - 8.0f;
+	return data;
+}
+
+TEST_CASE("Batch Transform", "[transform]")
+{
+	const Transform M = Transform::fromTranslation(Vector(1, -2, 3)) * Transform::fromRotation(Vector(1, 1, 0), 30) * Transform::fromScale(Vector(2, 3, 4));
+	const size_t count = 1000; // Not a multiple of the internal block size
+
+	const auto in = makeTriplets(count);
+	std::vector<float> expected(in.size());
+	naiveTransformPoints(M, in.data(), expected.data(), count);
+
+	// AoS in-place
+	std::vector<float> aos = in;
+	M.transformPoints(aos.data(), aos.data(), count);
+	for (size_t i = 0; i < aos.size(); ++i)
+		REQUIRE(aos[i] == Catch::Approx(expected[i]).margin(1e-4));
+
+	// SoA double
+	std::vector<double> x(count), y(count), z(count);
+	for (size_t i = 0; i < count; ++i) {
+		x[i] = in[3 * i + 0];
+		y[i] = in[3 * i + 1];
+		z[i] = in[3 * i + 2];
+	}
+	M.transformPoints(x.data(), y.data(), z.data(), x.data(), y.data(), z.data(), count);
+	for (size_t i = 0; i < count; ++i) {
+		REQUIRE(x[i] == Catch::Approx(expected[3 * i + 0]).margin(1e-4));
+		REQUIRE(y[i] == Catch::Approx(expected[3 * i + 1]).margin(1e-4));
+		REQUIRE(z[i] == Catch::Approx(expected[3 * i + 2]).margin(1e-4));
+	}
+
+	// Vectors ignore the translation
+	const float v[] = { 1, 0, 0 };
+	float rv[3];
+	Transform::fromTranslation(Vector(5, 5, 5)).transformVectors(v, rv, 1);
+	REQUIRE(rv[0] == 1);
+	REQUIRE(rv[1] == 0);
+	REQUIRE(rv[2] == 0);
+
+	// Normals stay orthogonal to transformed tangents
+	const double n[] = { 0, 0, 1 };
+	const double t[] = { 1, 1, 0 };
+	double rn[3], rt[3];
+	M.transformNormals(n, rn, 1);
+	M.transformVectors(t, rt, 1);
+	REQUIRE(rn[0] * rt[0] + rn[1] * rt[1] + rn[2] * rt[2] == Catch::Approx(0).margin(1e-5));
+	REQUIRE(rn[0] * rn[0] + rn[1] * rn[1] + rn[2] * rn[2] == Catch::Approx(1));
+
+	// Projective transforms divide by w
+	Transform P = Transform::fromIdentity();
+	P(3, 3)		= 2;
+	const float p[] = { 2, 4, 6 };
+	float rp[3];
+	P.transformPoints(p, rp, 1);
+	REQUIRE(rp[0] == 1);
+	REQUIRE(rp[1] == 2);
+	REQUIRE(rp[2] == 3);
+}
+
+TEST_CASE("Batch Transform Benchmark", "[transform][!benchmark]")
+{
+	const Transform M  = Transform::fromTranslation(Vector(1, -2, 3)) * Transform::fromRotation(Vector(1, 1, 0), 30);
+	const size_t count = 1 << 16;
+	const auto in	   = makeTriplets(count);
+	std::vector<float> out(in.size());
+
+	BENCHMARK("Naive")
+	{
+		naiveTransformPoints(M, in.data(), out.data(), count);
+		return out[0];
+	};
+
+	BENCHMARK("AoS")
+	{
+		M.transformPoints(in.data(), out.data(), count);
+		return out[0];
+	};
+
+	std::vector<float> x(count), y(count), z(count);
+	BENCHMARK("SoA")
+	{
+		M.transformPoints(x.data(), y.data(), z.data(), x.data(), y.data(), z.data(), count);
+		return x[0];
+	};
+}
+
+TEST_CASE("TRS Decomposition", "[transform]")
+{
+	const Transform M = Transform::fromTranslation(Vector(1, -2, 3)) * Transform::fromRotation(Vector(1, 1, 0), 30) * Transform::fromScale(Vector(2, 3, 4));
+	const auto trs	  = TransformTRS::fromTransform(M);
+	const auto R	  = trs.toTransform();
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j)
+			REQUIRE(R(i, j) == Catch::Approx(M(i, j)).margin(1e-4));
+	}
+	REQUIRE(trs.scale.x == Catch::Approx(2));
+	REQUIRE(trs.scale.y == Catch::Approx(3));
+	REQUIRE(trs.scale.z == Catch::Approx(4));
+}
+
+TEST_CASE("Animation Evaluator", "[transform]")
+{
+	// Unsorted on purpose
+	Animation anim;
+	anim.addKeyFrame(1, Transform::fromTranslation(Vector(2, 0, 0)));
+	anim.addKeyFrame(0, Transform::fromIdentity());
+	anim.addKeyFrame(2, Transform::fromTranslation(Vector(2, 0, 0)) * Transform::fromRotation(Vector(0, 0, 1), 90));
+
+	const AnimationEvaluator eval(anim);
+	REQUIRE(eval.keyFrameCount() == 3);
+	REQUIRE(eval.keyFrameTimes()[0] == 0);
+	REQUIRE(eval.keyFrameTimes()[2] == 2);
+	REQUIRE(eval.isUniform());
+
+	const auto M = eval.evaluate(0.5f);
+	REQUIRE(M(0, 3) == Catch::Approx(1));
+	REQUIRE(M(0, 0) == Catch::Approx(1));
+
+	const auto E = Transform::fromTranslation(Vector(2, 0, 0)) * Transform::fromRotation(Vector(0, 0, 1), 45);
+	const auto H = eval.evaluate(1.5f);
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j)
+			REQUIRE(H(i, j) == Catch::Approx(E(i, j)).margin(1e-5));
+	}
+
+	// Clamped outside of the range
+	REQUIRE(eval.evaluate(-1) == eval.evaluate(0));
+	REQUIRE(eval.evaluate(5)(0, 3) == Catch::Approx(2));
+
+	// Batched evaluation matches single evaluations, for uniform and non-uniform keyframes
+	anim.addKeyFrame(2.5f, Transform::fromScale(Vector(2, 2, 2)));
+	const AnimationEvaluator eval2(anim);
+	REQUIRE(!eval2.isUniform());
+	for (const auto* e : { &eval, &eval2 }) {
+		std::vector<Number> times;
+		for (int i = -2; i < 30; ++i)
+			times.push_back(Number(i) * 0.1f);
+		times.push_back(0.3f); // Not ascending
+
+		std::vector<Transform> out(times.size());
+		e->evaluate(times.data(), times.size(), out.data());
+		for (size_t i = 0; i < times.size(); ++i)
+			REQUIRE(out[i] == e->evaluate(times[i]));
+	}
+
+	REQUIRE(AnimationEvaluator().evaluate(1) == Transform::fromIdentity());
+}
@@ -1,10 +1,19 @@
 #include "tinyparser-mitsuba.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <unordered_set>
 
 #include <tinyxml2.h>
 
@@ -37,8 +46,15 @@ static inline std::string extractDirectoryOfPath(const std::string& str)
 	return (found == std::string::npos) ? "" : str.substr(0, found);
 }
 
-static inline std::string resolvePath(const std::string& path, const LookupPaths& lookups)
+// The directory of the file currently loaded has precedence over all other lookup paths
+static inline std::string resolvePath(const std::string& path, const std::string& fileDirectory, const LookupPaths& lookups)
 {
+	if (!fileDirectory.empty()) {
+		const std::string p = concactPaths(fileDirectory, path);
+		if (doesFileExist(p))
+			return p;
+	}
+
 	for (const auto& dir : lookups) {
 		const std::string p = concactPaths(dir, path);
 		if (doesFileExist(p))
@@ -51,6 +67,99 @@ static inline std::string resolvePath(const std::string& path, const LookupPaths
 		return "";
 }
 
+// ------------- Threading
+// Calls func(i) for all i in [0, count). The calling thread is part of the pool
+template <typename Func>
+static void parallelFor(size_t count, size_t threadCount, const Func& func)
+{
+	std::atomic<size_t> next(0);
+	const auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+			func(i);
+	};
+
+	if (threadCount == 0)
+		threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+	threadCount = std::min(threadCount, count);
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < threadCount; ++i)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for (auto& thread : threads)
+		thread.join();
+}
+
+// ------------- Load Cache
+// tinyxml2 decodes names and attributes on first access, which is a data race if multiple threads read a document.
+// Decoding everything upfront makes all further reads immutable
+static void decodeElements(const tinyxml2::XMLElement* element)
+{
+	for (; element; element = element->NextSiblingElement()) {
+		(void)element->Name();
+		for (auto attr = element->FirstAttribute(); attr; attr = attr->Next()) {
+			(void)attr->Name();
+			(void)attr->Value();
+		}
+		decodeElements(element->FirstChildElement());
+	}
+}
+
+// Resolved paths and include documents shared by concurrent loads.
+// Documents are only kept as long as a load (or a scene with lazy properties) still uses them
+class LoadCache {
+public:
+	// Lookup paths are the same for all loads, only the directory of the file currently loaded differs
+	inline std::string resolve(const std::string& path, const std::string& fileDirectory, const LookupPaths& lookups)
+	{
+		const std::string key = fileDirectory + '\n' + path;
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			const auto it = mPaths.find(key);
+			if (it != mPaths.end())
+				return it->second;
+		}
+
+		const std::string resolved = resolvePath(path, fileDirectory, lookups);
+
+		std::lock_guard<std::mutex> guard(mMutex);
+		mPaths[key] = resolved;
+		return resolved;
+	}
+
+	inline std::shared_ptr<const tinyxml2::XMLDocument> document(const std::string& fullPath)
+	{
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+			const auto it = mDocuments.find(fullPath);
+			if (it != mDocuments.end()) {
+				if (auto doc = it->second.lock())
+					return doc;
+			}
+		}
+
+		auto doc = std::make_shared<tinyxml2::XMLDocument>();
+		doc->LoadFile(fullPath.c_str());
+		decodeElements(doc->RootElement());
+
+		// Another thread might have been faster, stick to its document
+		std::lock_guard<std::mutex> guard(mMutex);
+		auto& entry = mDocuments[fullPath];
+		if (auto other = entry.lock())
+			return other;
+
+		entry = doc;
+		return doc;
+	}
+
+private:
+	std::mutex mMutex;
+	std::unordered_map<std::string, std::string> mPaths;
+	std::unordered_map<std::string, std::weak_ptr<const tinyxml2::XMLDocument>> mDocuments;
+};
+
 // ------------- String stuff
 static inline std::string handleCamelCase(const std::string& camelCase)
 {
@@ -129,6 +238,104 @@ Transform Transform::fromRotation(const Vector& axis, Number angle_degree)
 										 Number(0), Number(0), Number(0), Number(1) } });
 }
 
+Transform Transform::inverse(bool* ok) const
+{
+	const auto& m = matrix;
+
+	if (isAffine()) {
+		// Invert upper 3x3 block and transform the translation
+		const Number c00 = m[5] * m[10] - m[6] * m[9];
+		const Number c01 = m[6] * m[8] - m[4] * m[10];
+		const Number c02 = m[4] * m[9] - m[5] * m[8];
+		const Number det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+		if (det == Number(0)) {
+			if (ok)
+				*ok = false;
+			return fromIdentity();
+		}
+
+		const Number inv = Number(1) / det;
+		Transform r;
+		r.matrix[0]	 = c00 * inv;
+		r.matrix[1]	 = (m[2] * m[9] - m[1] * m[10]) * inv;
+		r.matrix[2]	 = (m[1] * m[6] - m[2] * m[5]) * inv;
+		r.matrix[4]	 = c01 * inv;
+		r.matrix[5]	 = (m[0] * m[10] - m[2] * m[8]) * inv;
+		r.matrix[6]	 = (m[2] * m[4] - m[0] * m[6]) * inv;
+		r.matrix[8]	 = c02 * inv;
+		r.matrix[9]	 = (m[1] * m[8] - m[0] * m[9]) * inv;
+		r.matrix[10] = (m[0] * m[5] - m[1] * m[4]) * inv;
+
+		for (int i = 0; i < 3; ++i)
+			r.matrix[i * 4 + 3] = -(r.matrix[i * 4 + 0] * m[3] + r.matrix[i * 4 + 1] * m[7] + r.matrix[i * 4 + 2] * m[11]);
+
+		r.matrix[12] = Number(0);
+		r.matrix[13] = Number(0);
+		r.matrix[14] = Number(0);
+		r.matrix[15] = Number(1);
+
+		if (ok)
+			*ok = true;
+		return r;
+	}
+
+	// General case based on the cofactors of 2x2 sub determinants
+	const Number s0 = m[0] * m[5] - m[4] * m[1];
+	const Number s1 = m[0] * m[6] - m[4] * m[2];
+	const Number s2 = m[0] * m[7] - m[4] * m[3];
+	const Number s3 = m[1] * m[6] - m[5] * m[2];
+	const Number s4 = m[1] * m[7] - m[5] * m[3];
+	const Number s5 = m[2] * m[7] - m[6] * m[3];
+
+	const Number c5 = m[10] * m[15] - m[14] * m[11];
+	const Number c4 = m[9] * m[15] - m[13] * m[11];
+	const Number c3 = m[9] * m[14] - m[13] * m[10];
+	const Number c2 = m[8] * m[15] - m[12] * m[11];
+	const Number c1 = m[8] * m[14] - m[12] * m[10];
+	const Number c0 = m[8] * m[13] - m[12] * m[9];
+
+	const Number det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+	if (det == Number(0)) {
+		if (ok)
+			*ok = false;
+		return fromIdentity();
+	}
+
+	const Number inv = Number(1) / det;
+	if (ok)
+		*ok = true;
+
+	return Transform(Transform::Array{ { (m[5] * c5 - m[6] * c4 + m[7] * c3) * inv,
+										 (-m[1] * c5 + m[2] * c4 - m[3] * c3) * inv,
+										 (m[13] * s5 - m[14] * s4 + m[15] * s3) * inv,
+										 (-m[9] * s5 + m[10] * s4 - m[11] * s3) * inv,
+
+										 (-m[4] * c5 + m[6] * c2 - m[7] * c1) * inv,
+										 (m[0] * c5 - m[2] * c2 + m[3] * c1) * inv,
+										 (-m[12] * s5 + m[14] * s2 - m[15] * s1) * inv,
+										 (m[8] * s5 - m[10] * s2 + m[11] * s1) * inv,
+
+										 (m[4] * c4 - m[5] * c2 + m[7] * c0) * inv,
+										 (-m[0] * c4 + m[1] * c2 - m[3] * c0) * inv,
+										 (m[12] * s4 - m[13] * s2 + m[15] * s0) * inv,
+										 (-m[8] * s4 + m[9] * s2 - m[11] * s0) * inv,
+
+										 (-m[4] * c3 + m[5] * c1 - m[6] * c0) * inv,
+										 (m[0] * c3 - m[1] * c1 + m[2] * c0) * inv,
+										 (-m[12] * s3 + m[13] * s1 - m[14] * s0) * inv,
+										 (m[8] * s3 - m[9] * s1 + m[10] * s0) * inv } });
+}
+
+Transform Transform::transposed() const
+{
+	Transform r;
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j)
+			r(i, j) = (*this)(j, i);
+	}
+	return r;
+}
+
 Transform Transform::fromLookAt(const Vector& origin, const Vector& target, const Vector& up)
 {
 	const Vector fwd	= normalize(Vector(target.x - origin.x, target.y - origin.y, target.z - origin.z));
@@ -141,10 +348,116 @@ Transform Transform::fromLookAt(const Vector& origin, const Vector& target, cons
 										 Number(0), Number(0), Number(0), Number(1) } });
 }
 
+// Rows of the result are linear combinations of the rows of the right matrix.
+// The summation order is the same as in the reference implementation
+#if !defined(TPM_EXACT_TRANSFORM) && !defined(TPM_NUMBER_AS_DOUBLE) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define TPM_TRANSFORM_SSE
+#elif !defined(TPM_EXACT_TRANSFORM) && defined(TPM_NUMBER_AS_DOUBLE) && defined(__AVX__)
+#define TPM_TRANSFORM_AVX
+#endif
+
+#if defined(TPM_TRANSFORM_SSE)
+#include <xmmintrin.h>
+
+static inline void multiplyRows(const Number* a, const Number* b, Number* r, int rows)
+{
+	const __m128 b0 = _mm_loadu_ps(b + 0);
+	const __m128 b1 = _mm_loadu_ps(b + 4);
+	const __m128 b2 = _mm_loadu_ps(b + 8);
+	const __m128 b3 = _mm_loadu_ps(b + 12);
+	for (int i = 0; i < rows; ++i) {
+		__m128 row = _mm_mul_ps(_mm_set1_ps(a[i * 4 + 0]), b0);
+		row		   = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 1]), b1));
+		row		   = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 2]), b2));
+		row		   = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 3]), b3));
+		_mm_storeu_ps(r + i * 4, row);
+	}
+}
+
+// Last row of b is (0,0,0,1), therefore only the translation column gets the fourth component
+static inline void multiplyAffineRows(const Number* a, const Number* b, Number* r)
+{
+	const __m128 b0 = _mm_loadu_ps(b + 0);
+	const __m128 b1 = _mm_loadu_ps(b + 4);
+	const __m128 b2 = _mm_loadu_ps(b + 8);
+	for (int i = 0; i < 3; ++i) {
+		__m128 row = _mm_mul_ps(_mm_set1_ps(a[i * 4 + 0]), b0);
+		row		   = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 1]), b1));
+		row		   = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[i * 4 + 2]), b2));
+		row		   = _mm_add_ps(row, _mm_set_ps(a[i * 4 + 3], 0, 0, 0));
+		_mm_storeu_ps(r + i * 4, row);
+	}
+}
+#elif defined(TPM_TRANSFORM_AVX)
+#include <immintrin.h>
+
+static inline void multiplyRows(const Number* a, const Number* b, Number* r, int rows)
+{
+	const __m256d b0 = _mm256_loadu_pd(b + 0);
+	const __m256d b1 = _mm256_loadu_pd(b + 4);
+	const __m256d b2 = _mm256_loadu_pd(b + 8);
+	const __m256d b3 = _mm256_loadu_pd(b + 12);
+	for (int i = 0; i < rows; ++i) {
+		__m256d row = _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 0]), b0);
+		row			= _mm256_add_pd(row, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 1]), b1));
+		row			= _mm256_add_pd(row, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 2]), b2));
+		row			= _mm256_add_pd(row, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 3]), b3));
+		_mm256_storeu_pd(r + i * 4, row);
+	}
+}
+
+static inline void multiplyAffineRows(const Number* a, const Number* b, Number* r)
+{
+	const __m256d b0 = _mm256_loadu_pd(b + 0);
+	const __m256d b1 = _mm256_loadu_pd(b + 4);
+	const __m256d b2 = _mm256_loadu_pd(b + 8);
+	for (int i = 0; i < 3; ++i) {
+		__m256d row = _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 0]), b0);
+		row			= _mm256_add_pd(row, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 1]), b1));
+		row			= _mm256_add_pd(row, _mm256_mul_pd(_mm256_set1_pd(a[i * 4 + 2]), b2));
+		row			= _mm256_add_pd(row, _mm256_set_pd(a[i * 4 + 3], 0, 0, 0));
+		_mm256_storeu_pd(r + i * 4, row);
+	}
+}
+#elif !defined(TPM_EXACT_TRANSFORM)
+// Fixed length inner loops are easy to vectorize for the compiler
+static inline void multiplyRows(const Number* a, const Number* b, Number* r, int rows)
+{
+	for (int i = 0; i < rows; ++i) {
+		Number row[4];
+		for (int j = 0; j < 4; ++j)
+			row[j] = a[i * 4 + 0] * b[j];
+		for (int k = 1; k < 4; ++k) {
+			for (int j = 0; j < 4; ++j)
+				row[j] += a[i * 4 + k] * b[k * 4 + j];
+		}
+		for (int j = 0; j < 4; ++j)
+			r[i * 4 + j] = row[j];
+	}
+}
+
+static inline void multiplyAffineRows(const Number* a, const Number* b, Number* r)
+{
+	for (int i = 0; i < 3; ++i) {
+		Number row[4];
+		for (int j = 0; j < 4; ++j)
+			row[j] = a[i * 4 + 0] * b[j];
+		for (int k = 1; k < 3; ++k) {
+			for (int j = 0; j < 4; ++j)
+				row[j] += a[i * 4 + k] * b[k * 4 + j];
+		}
+		row[3] += a[i * 4 + 3];
+		for (int j = 0; j < 4; ++j)
+			r[i * 4 + j] = row[j];
+	}
+}
+#endif
+
 Transform Transform::multiplyFromRight(const Transform& other) const
 {
 	Transform result;
 
+#ifdef TPM_EXACT_TRANSFORM
 	for (int i = 0; i < 4; ++i) {
 		for (int j = 0; j < 4; ++j) {
 			Number sum = 0;
@@ -153,823 +466,3839 @@ Transform Transform::multiplyFromRight(const Transform& other) const
 			result(i, j) = sum;
 		}
 	}
+#else
+	if (isAffine() && other.isAffine()) {
+		multiplyAffineRows(matrix.data(), other.matrix.data(), result.matrix.data());
+		result.matrix[12] = Number(0);
+		result.matrix[13] = Number(0);
+		result.matrix[14] = Number(0);
+		result.matrix[15] = Number(1);
+	} else {
+		multiplyRows(matrix.data(), other.matrix.data(), result.matrix.data(), 4);
+	}
+#endif
 
 	return result;
 }
 
-// ------------- Basic Parser
-template <typename T, typename Func>
-inline static int _parseScalars(const std::string& str, T* numbers, int amount, Func func)
+// ------------ Quaternion
+Vector Quaternion::rotate(const Vector& v) const
 {
-	size_t offset = 0;
-	int counter	  = 0;
-	for (counter = 0; counter < amount && offset < str.size(); ++counter) {
-		try {
-			size_t off;
-			numbers[counter] = func(str.substr(offset), &off);
-			offset += off;
-			if (offset >= str.size())
-				return counter + 1;
-			if (std::ispunct(str[offset]))
-				offset += 1;
-		} catch (...) {
-			return counter;
-		}
+	// v + 2w(q x v) + 2q x (q x v)
+	const Vector q(x, y, z);
+	const Vector t	= cross(q, v);
+	const Vector tt = cross(q, t);
+	return Vector(v.x + 2 * (w * t.x + tt.x),
+				  v.y + 2 * (w * t.y + tt.y),
+				  v.z + 2 * (w * t.z + tt.z));
+}
+
+Transform Quaternion::toTransform() const
+{
+	return Transform(Transform::Array{ { 1 - 2 * (y * y + z * z), 2 * (x * y - w * z), 2 * (x * z + w * y), Number(0),
+										 2 * (x * y + w * z), 1 - 2 * (x * x + z * z), 2 * (y * z - w * x), Number(0),
+										 2 * (x * z - w * y), 2 * (y * z + w * x), 1 - 2 * (x * x + y * y), Number(0),
+										 Number(0), Number(0), Number(0), Number(1) } });
+}
+
+Quaternion Quaternion::fromRotation(const Vector& axis, Number angle_degree)
+{
+	const auto half = degToRad(angle_degree) / 2;
+	const Vector aa = normalize(axis);
+	const auto sa	= std::sin(half);
+	return Quaternion(std::cos(half), aa.x * sa, aa.y * sa, aa.z * sa);
+}
+
+Quaternion Quaternion::fromMatrix(const Transform& m)
+{
+	const Number trace = m(0, 0) + m(1, 1) + m(2, 2);
+	if (trace > 0) {
+		const Number s = std::sqrt(trace + 1) * 2;
+		return Quaternion(s / 4, (m(2, 1) - m(1, 2)) / s, (m(0, 2) - m(2, 0)) / s, (m(1, 0) - m(0, 1)) / s);
+	} else if (m(0, 0) > m(1, 1) && m(0, 0) > m(2, 2)) {
+		const Number s = std::sqrt(1 + m(0, 0) - m(1, 1) - m(2, 2)) * 2;
+		return Quaternion((m(2, 1) - m(1, 2)) / s, s / 4, (m(0, 1) + m(1, 0)) / s, (m(0, 2) + m(2, 0)) / s);
+	} else if (m(1, 1) > m(2, 2)) {
+		const Number s = std::sqrt(1 + m(1, 1) - m(0, 0) - m(2, 2)) * 2;
+		return Quaternion((m(0, 2) - m(2, 0)) / s, (m(0, 1) + m(1, 0)) / s, s / 4, (m(1, 2) + m(2, 1)) / s);
+	} else {
+		const Number s = std::sqrt(1 + m(2, 2) - m(0, 0) - m(1, 1)) * 2;
+		return Quaternion((m(1, 0) - m(0, 1)) / s, (m(0, 2) + m(2, 0)) / s, (m(1, 2) + m(2, 1)) / s, s / 4);
 	}
+}
 
-	return counter;
+Quaternion Quaternion::slerp(const Quaternion& a, const Quaternion& b, Number t)
+{
+	Number cosTheta = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+	Quaternion c	= b;
+	if (cosTheta < 0) { // Take the shortest path
+		cosTheta = -cosTheta;
+		c		 = Quaternion(-b.w, -b.x, -b.y, -b.z);
+	}
+
+	Number wa, wb;
+	if (cosTheta > Number(0.9995)) { // Nearly parallel, fallback to linear interpolation
+		wa = 1 - t;
+		wb = t;
+	} else {
+		const Number theta = std::acos(cosTheta);
+		const Number sinT  = std::sin(theta);
+		wa				   = std::sin((1 - t) * theta) / sinT;
+		wb				   = std::sin(t * theta) / sinT;
+	}
+
+	Quaternion r(wa * a.w + wb * c.w, wa * a.x + wb * c.x, wa * a.y + wb * c.y, wa * a.z + wb * c.z);
+	const Number n = std::sqrt(r.w * r.w + r.x * r.x + r.y * r.y + r.z * r.z);
+	return Quaternion(r.w / n, r.x / n, r.y / n, r.z / n);
 }
 
-inline static Integer _parseInteger(const std::string& str, Integer* numbers, int amount)
+// ------------ TRS
+Transform TransformTRS::toTransform() const
 {
-	return _parseScalars(str, numbers, amount,
-						 [](const std::string& s, size_t* idx) { return (Integer)std::stoll(s, idx); });
+	Transform m = rotation.toTransform();
+	for (int i = 0; i < 3; ++i) {
+		m(i, 0) *= scale.x;
+		m(i, 1) *= scale.y;
+		m(i, 2) *= scale.z;
+	}
+	m(0, 3) = translation.x;
+	m(1, 3) = translation.y;
+	m(2, 3) = translation.z;
+	return m;
 }
 
-inline static int _parseNumber(const std::string& str, Number* numbers, int amount)
+static inline Number determinant3(const Number* m)
 {
-	return _parseScalars(str, numbers, amount,
-						 [](const std::string& s, size_t* idx) { return std::stof(s, idx); });
+	return m[0] * (m[4] * m[8] - m[5] * m[7])
+		   - m[1] * (m[3] * m[8] - m[5] * m[6])
+		   + m[2] * (m[3] * m[7] - m[4] * m[6]);
 }
 
-static void _parseVersion(const char* v, int& major, int& minor, int& patch)
+static inline bool inverseTranspose3(const Number* m, Number* r)
 {
-	major = 0;
-	minor = 6;
-	patch = 0;
+	const Number det = determinant3(m);
+	if (det == Number(0))
+		return false;
 
-	if (!v)
-		return;
+	const Number inv = 1 / det;
+	// Cofactor matrix
+	r[0] = (m[4] * m[8] - m[5] * m[7]) * inv;
+	r[1] = (m[5] * m[6] - m[3] * m[8]) * inv;
+	r[2] = (m[3] * m[7] - m[4] * m[6]) * inv;
+	r[3] = (m[2] * m[7] - m[1] * m[8]) * inv;
+	r[4] = (m[0] * m[8] - m[2] * m[6]) * inv;
+	r[5] = (m[1] * m[6] - m[0] * m[7]) * inv;
+	r[6] = (m[1] * m[5] - m[2] * m[4]) * inv;
+	r[7] = (m[2] * m[3] - m[0] * m[5]) * inv;
+	r[8] = (m[0] * m[4] - m[1] * m[3]) * inv;
+	return true;
+}
 
-	std::string version = v;
-	const auto s1		= version.find_first_of('.');
+TransformTRS TransformTRS::fromTransform(const Transform& transform)
+{
+	TransformTRS trs;
+	trs.translation = Vector(transform(0, 3), transform(1, 3), transform(2, 3));
 
-	major = std::stoi(version.substr(0, s1));
+	Number A[9];
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 3; ++j)
+			A[i * 3 + j] = transform(i, j);
+	}
 
-	if (s1 == std::string::npos) {
-		if (major > 0) {
-			minor = 0;
-			patch = 0;
+	// Polar decomposition A = R * S by averaging with the inverse transpose until R is orthogonal
+	Number R[9];
+	std::copy(A, A + 9, R);
+	bool valid = true;
+	for (int it = 0; it < 32; ++it) {
+		Number T[9];
+		if (!inverseTranspose3(R, T)) {
+			valid = false;
+			break;
 		}
-		return;
+
+		Number diff = 0;
+		for (int k = 0; k < 9; ++k) {
+			const Number next = (R[k] + T[k]) / 2;
+			diff			  = std::max(diff, std::abs(next - R[k]));
+			R[k]			  = next;
+		}
+
+		if (diff < Number(1e-6))
+			break;
 	}
 
-	const auto s2 = version.find_first_of('.', s1 + 1);
-	minor		  = std::stoi(version.substr(s1 + 1, s2));
+	if (!valid) { // Singular, only keep the diagonal
+		trs.scale = Vector(A[0], A[4], A[8]);
+		return trs;
+	}
 
-	if (s2 == std::string::npos)
-		return;
+	// Reflections are moved into the scale
+	if (determinant3(R) < 0) {
+		for (int k = 0; k < 9; ++k)
+			R[k] = -R[k];
+	}
 
-	patch = std::stoi(version.substr(s2 + 1));
+	// Diagonal of S = R^T * A
+	trs.scale = Vector(R[0] * A[0] + R[3] * A[3] + R[6] * A[6],
+					   R[1] * A[1] + R[4] * A[4] + R[7] * A[7],
+					   R[2] * A[2] + R[5] * A[5] + R[8] * A[8]);
+
+	trs.rotation = Quaternion::fromMatrix(Transform(Transform::Array{ { R[0], R[1], R[2], Number(0),
+																		 R[3], R[4], R[5], Number(0),
+																		 R[6], R[7], R[8], Number(0),
+																		 Number(0), Number(0), Number(0), Number(1) } }));
+	return trs;
 }
 
-static inline bool isidentifier(char c)
+TransformTRS TransformTRS::interpolate(const TransformTRS& a, const TransformTRS& b, Number t)
 {
-	return std::isalnum(c) || c == '_';
+	TransformTRS r;
+	r.translation = Vector(a.translation.x + (b.translation.x - a.translation.x) * t,
+						   a.translation.y + (b.translation.y - a.translation.y) * t,
+						   a.translation.z + (b.translation.z - a.translation.z) * t);
+	r.rotation	  = Quaternion::slerp(a.rotation, b.rotation, t);
+	r.scale		  = Vector(a.scale.x + (b.scale.x - a.scale.x) * t,
+						   a.scale.y + (b.scale.y - a.scale.y) * t,
+						   a.scale.z + (b.scale.z - a.scale.z) * t);
+	return r;
 }
 
-static std::string unpackValues(const char* str, const ArgumentContainer& cnt)
+// ------------ Animation
+AnimationEvaluator::AnimationEvaluator(const Animation& animation)
 {
-	std::string unpackedStr;
-	for (int i = 0; str[i];) {
-		if (str[i] == '$') {
-			std::string variable;
-			++i;
-			for (; str[i] && isidentifier(str[i]); ++i) {
-				variable += str[i];
-			}
-			if (!variable.empty()) {
-				if (!cnt.count(variable))
-					throw std::runtime_error("Unknown variable " + variable);
+	const auto& times = animation.keyFrameTimes();
+	std::vector<size_t> order(times.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return times[a] < times[b]; });
+
+	mTimes.reserve(order.size());
+	mKeyFrames.reserve(order.size());
+	for (size_t i : order) {
+		mTimes.push_back(times[i]);
+		mKeyFrames.push_back(TransformTRS::fromTransform(animation.keyFrameTransforms()[i]));
+	}
 
-				unpackedStr += cnt.at(variable);
-			}
-		} else {
-			unpackedStr += str[i];
-			++i;
-		}
+	if (mTimes.size() < 2)
+		return;
+
+	const Number step = (mTimes.back() - mTimes.front()) / Number(mTimes.size() - 1);
+	if (step <= 0)
+		return;
+
+	mUniform = true;
+	for (size_t i = 1; i < mTimes.size() && mUniform; ++i) {
+		const Number expected = mTimes.front() + step * Number(i);
+		mUniform			  = std::abs(mTimes[i] - expected) <= step * Number(1e-4);
 	}
-	return unpackedStr;
+	mInvStep = mUniform ? 1 / step : Number(0);
 }
 
-static inline bool unpackInteger(const char* str, const ArgumentContainer& cnt, Integer* value)
+// Returns the index of the first keyframe of the segment containing the time
+size_t AnimationEvaluator::findSegment(Number time, size_t hint) const
 {
-	if (!str)
-		return false;
+	const size_t last = mTimes.size() - 2;
+	if (time <= mTimes.front())
+		return 0;
+	if (time >= mTimes.back())
+		return last;
+
+	if (mUniform) {
+		const size_t i = static_cast<size_t>((time - mTimes.front()) * mInvStep);
+		return std::min(i, last);
+	}
 
-	const std::string valueStr = unpackValues(str, cnt);
-	return _parseInteger(valueStr, value, 1) == 1;
+	if (hint <= last && mTimes[hint] <= time && time <= mTimes[hint + 1])
+		return hint;
+
+	const auto it = std::upper_bound(mTimes.begin(), mTimes.end(), time);
+	return std::min(static_cast<size_t>(it - mTimes.begin()) - 1, last);
 }
 
-static inline bool unpackNumber(const char* str, const ArgumentContainer& cnt, Number* value)
+TransformTRS AnimationEvaluator::interpolate(size_t segment, Number time) const
 {
-	if (!str)
-		return false;
+	const Number t0 = mTimes[segment];
+	const Number t1 = mTimes[segment + 1];
+	const Number dt = t1 - t0;
+	const Number t	= dt > 0 ? std::min(Number(1), std::max(Number(0), (time - t0) / dt)) : Number(0);
+	return TransformTRS::interpolate(mKeyFrames[segment], mKeyFrames[segment + 1], t);
+}
 
-	const std::string valueStr = unpackValues(str, cnt);
-	return _parseNumber(valueStr, value, 1) == 1;
+TransformTRS AnimationEvaluator::evaluateTRS(Number time) const
+{
+	if (mKeyFrames.empty())
+		return TransformTRS();
+	if (mKeyFrames.size() == 1)
+		return mKeyFrames.front();
+
+	return interpolate(findSegment(time, 0), time);
 }
 
-static inline bool unpackVector(const char* str, const ArgumentContainer& cnt, Vector* value, Number fill = Number(0))
+void AnimationEvaluator::evaluate(const Number* times, size_t count, TransformTRS* out) const
 {
-	if (!str)
-		return false;
+	if (mKeyFrames.size() < 2) {
+		std::fill(out, out + count, mKeyFrames.empty() ? TransformTRS() : mKeyFrames.front());
+		return;
+	}
 
-	const std::string valueStr = unpackValues(str, cnt);
-	Number tmp[3];
-	auto c = _parseNumber(valueStr, tmp, 3);
-	if (c >= 1) {
-		value->x = tmp[0];
-		value->y = c >= 2 ? tmp[1] : fill;
-		value->z = c >= 3 ? tmp[2] : fill;
-		return true;
-	} else {
-		return false;
+	size_t segment = 0;
+	for (size_t i = 0; i < count; ++i) {
+		segment = findSegment(times[i], segment);
+		out[i]	= interpolate(segment, times[i]);
 	}
 }
 
-//--------------- ID Container
-class IDContainer {
-public:
-	inline void registerID(const std::string& id, const std::shared_ptr<Object>& entity)
-	{
-		mMap[id] = entity;
+void AnimationEvaluator::evaluate(const Number* times, size_t count, Transform* out) const
+{
+	if (mKeyFrames.size() < 2) {
+		std::fill(out, out + count, mKeyFrames.empty() ? Transform::fromIdentity() : mKeyFrames.front().toTransform());
+		return;
 	}
 
-	inline bool hasID(const std::string& id) const { return mMap.count(id) > 0; }
+	size_t segment = 0;
+	for (size_t i = 0; i < count; ++i) {
+		segment = findSegment(times[i], segment);
+		out[i]	= interpolate(segment, times[i]).toTransform();
+	}
+}
 
-	inline std::shared_ptr<Object> get(const std::string& id) const
-	{
-		return hasID(id) ? mMap.at(id) : nullptr;
+// ------------- Batch Transform
+enum BatchKind {
+	BK_POINT = 0,
+	BK_PROJECTIVE_POINT,
+	BK_VECTOR,
+	BK_NORMAL
+};
+
+// Kernels work in place on fixed size blocks. As the component arrays of a block can not alias,
+// the loops are vectorized by the compiler without any runtime checks
+constexpr size_t BatchBlockSize = 256;
+
+template <typename T>
+struct BatchBlock {
+	T X[BatchBlockSize];
+	T Y[BatchBlockSize];
+	T Z[BatchBlockSize];
+};
+
+template <typename T, BatchKind Kind>
+static inline void transformBatchBlock(const Number* m, BatchBlock<T>& block, size_t count)
+{
+	const T m00 = T(m[0]), m01 = T(m[1]), m02 = T(m[2]), m03 = T(m[3]);
+	const T m10 = T(m[4]), m11 = T(m[5]), m12 = T(m[6]), m13 = T(m[7]);
+	const T m20 = T(m[8]), m21 = T(m[9]), m22 = T(m[10]), m23 = T(m[11]);
+	const T m30 = T(m[12]), m31 = T(m[13]), m32 = T(m[14]), m33 = T(m[15]);
+
+	for (size_t i = 0; i < count; ++i) {
+		const T x = block.X[i];
+		const T y = block.Y[i];
+		const T z = block.Z[i];
+
+		T rx = m00 * x + m01 * y + m02 * z;
+		T ry = m10 * x + m11 * y + m12 * z;
+		T rz = m20 * x + m21 * y + m22 * z;
+		if (Kind == BK_POINT || Kind == BK_PROJECTIVE_POINT) {
+			rx += m03;
+			ry += m13;
+			rz += m23;
+		}
+
+		if (Kind == BK_PROJECTIVE_POINT) {
+			const T iw = T(1) / (m30 * x + m31 * y + m32 * z + m33);
+			rx *= iw;
+			ry *= iw;
+			rz *= iw;
+		}
+
+		block.X[i] = rx;
+		block.Y[i] = ry;
+		block.Z[i] = rz;
 	}
 
-	inline void makeAlias(const std::string& id, const std::string& as)
-	{
-		if (!mMap.count(id))
-			return;
+	if (Kind == BK_NORMAL) {
+		for (size_t i = 0; i < count; ++i) {
+			const T len = std::sqrt(block.X[i] * block.X[i] + block.Y[i] * block.Y[i] + block.Z[i] * block.Z[i]);
+			const T il	= len > T(0) ? T(1) / len : T(0);
+			block.X[i] *= il;
+			block.Y[i] *= il;
+			block.Z[i] *= il;
+		}
+	}
+}
 
-		mMap[as] = mMap.at(id);
+template <typename T, BatchKind Kind>
+static void transformBatchSoA(const Number* m, const T* inX, const T* inY, const T* inZ, T* outX, T* outY, T* outZ, size_t count)
+{
+	BatchBlock<T> block;
+	for (size_t start = 0; start < count; start += BatchBlockSize) {
+		const size_t n = std::min(BatchBlockSize, count - start);
+		std::copy(inX + start, inX + start + n, block.X);
+		std::copy(inY + start, inY + start + n, block.Y);
+		std::copy(inZ + start, inZ + start + n, block.Z);
+
+		transformBatchBlock<T, Kind>(m, block, n);
+
+		std::copy(block.X, block.X + n, outX + start);
+		std::copy(block.Y, block.Y + n, outY + start);
+		std::copy(block.Z, block.Z + n, outZ + start);
 	}
+}
 
-private:
-	std::unordered_map<std::string, std::shared_ptr<Object>> mMap;
-};
+// Triplets are transposed blockwise into component arrays
+template <typename T, BatchKind Kind>
+static void transformBatchAoS(const Number* m, const T* in, T* out, size_t count)
+{
+	BatchBlock<T> block;
+	for (size_t start = 0; start < count; start += BatchBlockSize) {
+		const size_t n = std::min(BatchBlockSize, count - start);
+		const T* src   = in + 3 * start;
+		for (size_t i = 0; i < n; ++i) {
+			block.X[i] = src[3 * i + 0];
+			block.Y[i] = src[3 * i + 1];
+			block.Z[i] = src[3 * i + 2];
+		}
 
-// Object type to parser flag
-#define OT_PF(x) (1 << (x))
+		transformBatchBlock<T, Kind>(m, block, n);
 
-enum ParseFlags {
-	PF_BSDF		  = OT_PF(OT_BSDF),
-	PF_EMITTER	  = OT_PF(OT_EMITTER),
-	PF_FILM		  = OT_PF(OT_FILM),
-	PF_INTEGRATOR = OT_PF(OT_INTEGRATOR),
-	PF_MEDIUM	  = OT_PF(OT_MEDIUM),
-	PF_PHASE	  = OT_PF(OT_PHASE),
-	PF_RFILTER	  = OT_PF(OT_RFILTER),
-	PF_SAMPLER	  = OT_PF(OT_SAMPLER),
-	PF_SENSOR	  = OT_PF(OT_SENSOR),
-	PF_SHAPE	  = OT_PF(OT_SHAPE),
-	PF_SUBSURFACE = OT_PF(OT_SUBSURFACE),
-	PF_TEXTURE	  = OT_PF(OT_TEXTURE),
-	PF_VOLUME	  = OT_PF(OT_VOLUME),
+		T* dst = out + 3 * start;
+		for (size_t i = 0; i < n; ++i) {
+			dst[3 * i + 0] = block.X[i];
+			dst[3 * i + 1] = block.Y[i];
+			dst[3 * i + 2] = block.Z[i];
+		}
+	}
+}
 
-	PF_REFERENCE = OT_PF(_OT_COUNT + 0),
-	PF_DEFAULT	 = OT_PF(_OT_COUNT + 1),
-	PF_ALIAS	 = OT_PF(_OT_COUNT + 2),
-	PF_PARAMETER = OT_PF(_OT_COUNT + 3),
-	PF_INCLUDE	 = OT_PF(_OT_COUNT + 4),
-	PF_NULL		 = OT_PF(_OT_COUNT + 5),
+void Transform::transformPoints(const float* in, float* out, size_t count) const
+{
+	if (isAffine())
+		transformBatchAoS<float, BK_POINT>(matrix.data(), in, out, count);
+	else
+		transformBatchAoS<float, BK_PROJECTIVE_POINT>(matrix.data(), in, out, count);
+}
 
-	// Compositions extracted from the official schema
-	PF_C_OBJECTGROUP = PF_PARAMETER | PF_DEFAULT,
-	PF_C_BSDF		 = PF_C_OBJECTGROUP | PF_PHASE | PF_TEXTURE | PF_BSDF | PF_REFERENCE,
-	PF_C_EMITTER	 = PF_C_OBJECTGROUP | PF_TEXTURE | PF_EMITTER | PF_MEDIUM | PF_REFERENCE,
-	PF_C_FILM		 = PF_C_OBJECTGROUP | PF_RFILTER,
-	PF_C_INTEGRATOR	 = PF_C_OBJECTGROUP | PF_INTEGRATOR | PF_SAMPLER,
-	PF_C_MEDIUM		 = PF_C_OBJECTGROUP | PF_SHAPE | PF_VOLUME | PF_PHASE,
-	PF_C_PHASE		 = PF_C_OBJECTGROUP | PF_PHASE,
-	PF_C_SAMPLER	 = PF_C_OBJECTGROUP,
-	PF_C_SCENE		 = PF_C_OBJECTGROUP | PF_ALIAS | PF_SENSOR | PF_TEXTURE | PF_BSDF | PF_SUBSURFACE | PF_INTEGRATOR | PF_EMITTER | PF_SHAPE | PF_MEDIUM | PF_PHASE | PF_INCLUDE | PF_NULL,
-	PF_C_SENSOR		 = PF_C_OBJECTGROUP | PF_SENSOR | PF_FILM | PF_MEDIUM | PF_SAMPLER | PF_REFERENCE,
-	PF_C_SHAPE		 = PF_C_OBJECTGROUP | PF_BSDF | PF_SUBSURFACE | PF_SENSOR | PF_EMITTER | PF_SHAPE | PF_MEDIUM | PF_TEXTURE | PF_RFILTER | PF_REFERENCE,
-	PF_C_SUBSURFACE	 = PF_C_OBJECTGROUP | PF_PHASE | PF_BSDF,
-	PF_C_RFILTER	 = PF_C_OBJECTGROUP,
-	PF_C_TEXTURE	 = PF_C_OBJECTGROUP | PF_TEXTURE | PF_RFILTER | PF_REFERENCE,
-	PF_C_VOLUME		 = PF_C_OBJECTGROUP | PF_VOLUME,
-};
+void Transform::transformPoints(const double* in, double* out, size_t count) const
+{
+	if (isAffine())
+		transformBatchAoS<double, BK_POINT>(matrix.data(), in, out, count);
+	else
+		transformBatchAoS<double, BK_PROJECTIVE_POINT>(matrix.data(), in, out, count);
+}
 
-struct ParseContext {
-	const TPM_NAMESPACE::ArgumentContainer& Arguments;
-	const TPM_NAMESPACE::LookupPaths& LookupPaths;
-	const bool ConvertCamelCase;
-};
+void Transform::transformPoints(const float* inX, const float* inY, const float* inZ, float* outX, float* outY, float* outZ, size_t count) const
+{
+	if (isAffine())
+		transformBatchSoA<float, BK_POINT>(matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
+	else
+		transformBatchSoA<float, BK_PROJECTIVE_POINT>(matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
+}
 
-static inline Property parseInteger(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Transform::transformPoints(const double* inX, const double* inY, const double* inZ, double* outX, double* outY, double* outZ, size_t count) const
 {
-	Integer value;
-	return unpackInteger(element->Attribute("value"), ctx.Arguments, &value) ? Property::fromInteger(value) : Property();
+	if (isAffine())
+		transformBatchSoA<double, BK_POINT>(matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
+	else
+		transformBatchSoA<double, BK_PROJECTIVE_POINT>(matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
 }
 
-static inline Property parseFloat(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Transform::transformVectors(const float* in, float* out, size_t count) const
 {
-	Number value;
-	return unpackNumber(element->Attribute("value"), ctx.Arguments, &value) ? Property::fromNumber(value) : Property();
+	transformBatchAoS<float, BK_VECTOR>(matrix.data(), in, out, count);
 }
 
-static inline Property parseVector(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Transform::transformVectors(const double* in, double* out, size_t count) const
 {
-	auto attrib = element->Attribute("value");
-	if (!attrib) { // Try legacy way
-		Number x, y, z;
-		if (!unpackNumber(element->Attribute("x"), ctx.Arguments, &x))
-			return Property();
-		if (!unpackNumber(element->Attribute("y"), ctx.Arguments, &y))
-			return Property();
-		if (!unpackNumber(element->Attribute("z"), ctx.Arguments, &z))
-			return Property();
+	transformBatchAoS<double, BK_VECTOR>(matrix.data(), in, out, count);
+}
 
-		return Property::fromVector(Vector(x, y, z));
-	} else {
-		Vector v;
-		if (!unpackVector(attrib, ctx.Arguments, &v))
-			return Property();
+void Transform::transformVectors(const float* inX, const float* inY, const float* inZ, float* outX, float* outY, float* outZ, size_t count) const
+{
+	transformBatchSoA<float, BK_VECTOR>(matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
+}
 
-		return Property::fromVector(v);
-	}
+void Transform::transformVectors(const double* inX, const double* inY, const double* inZ, double* outX, double* outY, double* outZ, size_t count) const
+{
+	transformBatchSoA<double, BK_VECTOR>(matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
 }
 
-static inline Property parseBool(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Transform::transformNormals(const float* in, float* out, size_t count) const
 {
-	auto attrib = element->Attribute("value");
-	if (!attrib)
-		return Property();
+	const Transform normalMatrix = inverse().transposed();
+	transformBatchAoS<float, BK_NORMAL>(normalMatrix.matrix.data(), in, out, count);
+}
 
-	const auto valueStr = unpackValues(attrib, ctx.Arguments);
-	if (valueStr == "true")
-		return Property::fromBool(true);
-	else if (valueStr == "false")
-		return Property::fromBool(false);
-	else
-		return Property();
+void Transform::transformNormals(const double* in, double* out, size_t count) const
+{
+	const Transform normalMatrix = inverse().transposed();
+	transformBatchAoS<double, BK_NORMAL>(normalMatrix.matrix.data(), in, out, count);
 }
 
-static Property parseRGB(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Transform::transformNormals(const float* inX, const float* inY, const float* inZ, float* outX, float* outY, float* outZ, size_t count) const
 {
-	// TODO
-	auto intent = element->Attribute("intent");
-	(void)intent;
+	const Transform normalMatrix = inverse().transposed();
+	transformBatchSoA<float, BK_NORMAL>(normalMatrix.matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
+}
 
-	auto attrib = element->Attribute("value");
-	if (!attrib) { // Try legacy way
-		Number r, g, b;
-		if (!unpackNumber(element->Attribute("r"), ctx.Arguments, &r))
-			return Property();
-		if (!unpackNumber(element->Attribute("g"), ctx.Arguments, &g))
-			return Property();
-		if (!unpackNumber(element->Attribute("b"), ctx.Arguments, &b))
-			return Property();
+void Transform::transformNormals(const double* inX, const double* inY, const double* inZ, double* outX, double* outY, double* outZ, size_t count) const
+{
+	const Transform normalMatrix = inverse().transposed();
+	transformBatchSoA<double, BK_NORMAL>(normalMatrix.matrix.data(), inX, inY, inZ, outX, outY, outZ, count);
+}
 
-		return Property::fromColor(Color(r, g, b));
+// ------------- Spectrum
+// Index of the segment [wvls[i], wvls[i+1]] containing the wavelength, starting the search at the hint
+static inline size_t findSpectrumSegment(const std::vector<Number>& wvls, Number wavelength, size_t hint)
+{
+	if (hint >= wvls.size() || wavelength < wvls[hint]) {
+		hint = std::upper_bound(wvls.begin(), wvls.end(), wavelength) - wvls.begin();
 	} else {
-		Vector v;
-		if (!unpackVector(attrib, ctx.Arguments, &v))
-			return Property();
-
-		return Property::fromColor(Color(v.x, v.y, v.z));
+		// Sorted queries advance by a few segments at most, larger jumps fall back to the binary search
+		const size_t end = std::min(wvls.size(), hint + 4);
+		while (hint < end && wvls[hint] <= wavelength)
+			++hint;
+		if (hint == end && hint < wvls.size() && wvls[hint] <= wavelength)
+			hint = std::upper_bound(wvls.begin() + hint, wvls.end(), wavelength) - wvls.begin();
 	}
+
+	return hint == 0 ? 0 : hint - 1;
 }
 
-static Property parseSpectrum(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+static inline Number evaluateSpectrumSegment(const std::vector<Number>& wvls, const std::vector<Number>& weights, size_t count,
+											 Number wavelength, size_t segment)
 {
-	auto intent = element->Attribute("intent");
-	(void)intent;
+	if (wavelength < wvls[0] || wavelength > wvls[count - 1])
+		return Number(0);
+	if (segment + 1 >= count)
+		return weights[count - 1];
+
+	const Number width = wvls[segment + 1] - wvls[segment];
+	const Number t	   = width > Number(0) ? (wavelength - wvls[segment]) / width : Number(0);
+	return weights[segment] + t * (weights[segment + 1] - weights[segment]);
+}
 
-	auto filename = element->Attribute("filename");
-	if (filename) { // Load from .spd files!
-		const std::string unpacked_filename = unpackValues(filename, ctx.Arguments);
-		const std::string full_path			= resolvePath(unpacked_filename, ctx.LookupPaths);
+Number Spectrum::evaluate(Number wavelength) const
+{
+	Number out;
+	evaluate(&wavelength, &out, 1);
+	return out;
+}
 
-		if (full_path.empty())
-			throw std::runtime_error("File " + std::string(unpacked_filename) + " not found");
+void Spectrum::evaluate(const Number* wavelengths, Number* out, size_t count) const
+{
+	if (isUniform()) {
+		std::fill(out, out + count, uniformValue());
+		return;
+	}
 
-		std::vector<int> wvls;
-		std::vector<Number> weights;
-		std::ifstream stream(full_path, std::ios::in);
-		std::string line;
-		while (std::getline(stream, line)) {
-			size_t comment_start = line.find_first_of('#');
-			const auto part		 = line.substr(0, comment_start);
-			if (part.empty())
-				continue;
+	const size_t samples = std::min(mWavelengths.size(), mWeights.size());
+	if (samples == 0) {
+		std::fill(out, out + count, Number(0));
+		return;
+	}
 
-			Number tmp[2];
-			int i = _parseNumber(part, tmp, 2);
-			if (i == 2) {
-				wvls.push_back((int)tmp[0]);
-				weights.push_back(tmp[1]);
-			}
-		}
+	size_t segment = 0;
+	for (size_t i = 0; i < count; ++i) {
+		segment = findSpectrumSegment(mWavelengths, wavelengths[i], segment);
+		out[i]	= evaluateSpectrumSegment(mWavelengths, mWeights, samples, wavelengths[i], segment);
+	}
+}
 
-		return Property::fromSpectrum(Spectrum(wvls, weights));
-	} else {
-		auto value = element->Attribute("value");
-		if (!value)
-			return Property();
+// ------------- Hashing
+static inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+	return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
 
-		const auto valueStr = unpackValues(value, ctx.Arguments);
+static inline uint64_t hashNumber(Number v)
+{
+	if (v == Number(0)) // -0 and 0 are equal
+		v = Number(0);
 
-		constexpr size_t MAX_SPEC = 1024;
-		Number tmp[MAX_SPEC];
-		auto c = _parseNumber(valueStr, tmp, MAX_SPEC);
+	uint64_t bits = 0;
+	std::memcpy(&bits, &v, sizeof(v));
+	return bits;
+}
 
-		if (c == 1) {			 // Uniform
-			return Property::fromSpectrum(Spectrum(tmp[0]));
-		} else if (c % 2 == 0) { // Wavelength + Weight pairs
-			std::vector<int> wvls;
-			std::vector<Number> weights;
-			wvls.resize(c / 2);
-			weights.resize(c / 2);
-
-			for (int i = 0; i < c / 2; ++i) {
-				wvls[i]	   = tmp[i * 2];
-				weights[i] = tmp[i * 2 + 1];
-			}
-			return Property::fromSpectrum(Spectrum(wvls, weights));
-		} else {
-			return Property();
+static inline uint64_t hashTransform(const Transform& t)
+{
+	uint64_t h = 0;
+	for (const auto& v : t.matrix)
+		h = hashCombine(h, hashNumber(v));
+	return h;
+}
+
+static uint64_t hashSpectrum(const Spectrum& spec)
+{
+	uint64_t h = 0;
+	for (const auto& w : spec.wavelengths())
+		h = hashCombine(h, hashNumber(w));
+	for (const auto& w : spec.weights())
+		h = hashCombine(h, hashNumber(w));
+	return h;
+}
+
+static uint64_t hashProperty(const Property& prop)
+{
+	uint64_t h = prop.type();
+	switch (prop.type()) {
+	case PT_ANIMATION: {
+		// Explicit default, as a reference to the default argument would dangle
+		const Animation empty;
+		const auto& anim = prop.getAnimation(empty);
+		for (size_t i = 0; i < anim.keyFrameCount(); ++i) {
+			h = hashCombine(h, hashNumber(anim.keyFrameTimes()[i]));
+			h = hashCombine(h, hashTransform(anim.keyFrameTransforms()[i]));
 		}
+	} break;
+	case PT_BLACKBODY:
+		h = hashCombine(h, hashNumber(prop.getBlackbody().temperature));
+		h = hashCombine(h, hashNumber(prop.getBlackbody().scale));
+		break;
+	case PT_BOOL:
+		h = hashCombine(h, prop.getBool() ? 1 : 0);
+		break;
+	case PT_INTEGER:
+		h = hashCombine(h, (uint64_t)prop.getInteger());
+		break;
+	case PT_NUMBER:
+		h = hashCombine(h, hashNumber(prop.getNumber()));
+		break;
+	case PT_COLOR:
+		h = hashCombine(h, hashNumber(prop.getColor().r));
+		h = hashCombine(h, hashNumber(prop.getColor().g));
+		h = hashCombine(h, hashNumber(prop.getColor().b));
+		break;
+	case PT_SPECTRUM:
+		h = hashCombine(h, hashSpectrum(prop.getSpectrum()));
+		break;
+	case PT_STRING:
+		h = hashCombine(h, std::hash<std::string>()(prop.getString()));
+		break;
+	case PT_TRANSFORM:
+		h = hashCombine(h, hashTransform(prop.getTransform()));
+		break;
+	case PT_VECTOR:
+		h = hashCombine(h, hashNumber(prop.getVector().x));
+		h = hashCombine(h, hashNumber(prop.getVector().y));
+		h = hashCombine(h, hashNumber(prop.getVector().z));
+		break;
+	default:
+		break;
 	}
+	return h;
 }
 
-static Property parseBlackbody(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+// ------------- Object
+Object::Object(const Object& other)
+	: mType(other.mType)
+	, mPluginType(other.mPluginType)
+	, mID(other.mID)
+	, mProperties(other.mProperties)
+	, mChildren(other.mChildren)
+	, mNamedChildren(other.mNamedChildren)
+	, mOrderedChildren(other.mOrderedChildren)
+	, mParent(other.mParent)
+	, mBound(other.mBound)
+	, mBoundType(other.mBoundType)
+	, mHash(other.mHash)
+	, mHashValid(other.mHashValid)
+	, mPropertiesHash(other.mPropertiesHash)
+	, mPropertiesHashValid(other.mPropertiesHashValid)
 {
-	Number temp, scale;
-	if (!unpackNumber(element->Attribute("temperature"), ctx.Arguments, &temp))
-		return Property();
+	adoptChildren();
+}
 
-	if (!unpackNumber(element->Attribute("scale"), ctx.Arguments, &scale))
-		scale = Number(1);
+// Holders of the original keep pointing to it, therefore only the children are handed over
+Object::Object(Object&& other)
+	: mType(other.mType)
+	, mPluginType(std::move(other.mPluginType))
+	, mID(std::move(other.mID))
+	, mProperties(std::move(other.mProperties))
+	, mParent(other.mParent)
+	, mBound(std::move(other.mBound))
+	, mBoundType(other.mBoundType)
+	, mHash(other.mHash)
+	, mHashValid(other.mHashValid)
+	, mPropertiesHash(other.mPropertiesHash)
+	, mPropertiesHashValid(other.mPropertiesHashValid)
+	, mJournal(std::move(other.mJournal))
+	, mJournalGeneration(other.mJournalGeneration)
+{
+	other.releaseChildren();
+	mChildren		 = std::move(other.mChildren);
+	mNamedChildren	 = std::move(other.mNamedChildren);
+	mOrderedChildren = std::move(other.mOrderedChildren);
+	other.mChildren.clear();
+	other.mNamedChildren.clear();
+	other.mOrderedChildren.clear();
+	other.invalidateHash(true);
+	adoptChildren();
+}
 
-	return Property::fromBlackbody(Blackbody(temp, scale));
+Object::~Object()
+{
+	releaseChildren();
 }
 
-static Property parseString(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+Object& Object::operator=(const Object& other)
 {
-	auto attrib = element->Attribute("value");
-	if (!attrib)
-		return Property();
-	return Property::fromString(unpackValues(attrib, ctx.Arguments));
+	if (this == &other)
+		return *this;
+
+	// Cached hashes containing this object are outdated
+	invalidateHash(true);
+	releaseChildren();
+
+	mType				 = other.mType;
+	mPluginType			 = other.mPluginType;
+	mID					 = other.mID;
+	mProperties			 = other.mProperties;
+	mChildren			 = other.mChildren;
+	mNamedChildren		 = other.mNamedChildren;
+	mOrderedChildren	 = other.mOrderedChildren;
+	mParent				 = other.mParent;
+	mBound				 = other.mBound;
+	mBoundType			 = other.mBoundType;
+	mHash				 = other.mHash;
+	mHashValid			 = other.mHashValid;
+	mPropertiesHash		 = other.mPropertiesHash;
+	mPropertiesHashValid = other.mPropertiesHashValid;
+	adoptChildren();
+
+	// The journal belongs to the original
+	mJournal.reset();
+	mJournalGeneration = 0;
+	return *this;
 }
 
-// ---------- Transform Parameter
-Transform parseTransformTranslate(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+Object& Object::operator=(Object&& other)
 {
-	Vector delta;
-	auto value = element->Attribute("value");
-	if (value) {
-		if (!unpackVector(value, ctx.Arguments, &delta))
-			delta = Vector(0, 0, 0);
-	} else {
-		if (!unpackNumber(element->Attribute("x"), ctx.Arguments, &delta.x))
-			delta.x = 0;
-		if (!unpackNumber(element->Attribute("y"), ctx.Arguments, &delta.y))
-			delta.y = 0;
-		if (!unpackNumber(element->Attribute("z"), ctx.Arguments, &delta.z))
-			delta.z = 0;
+	if (this == &other)
+		return *this;
+
+	invalidateHash(true);
+	releaseChildren();
+	other.releaseChildren();
+
+	mType				 = other.mType;
+	mPluginType			 = std::move(other.mPluginType);
+	mID					 = std::move(other.mID);
+	mProperties			 = std::move(other.mProperties);
+	mChildren			 = std::move(other.mChildren);
+	mNamedChildren		 = std::move(other.mNamedChildren);
+	mOrderedChildren	 = std::move(other.mOrderedChildren);
+	mParent				 = other.mParent;
+	mBound				 = std::move(other.mBound);
+	mBoundType			 = other.mBoundType;
+	mHash				 = other.mHash;
+	mHashValid			 = other.mHashValid;
+	mPropertiesHash		 = other.mPropertiesHash;
+	mPropertiesHashValid = other.mPropertiesHashValid;
+	mJournal			 = std::move(other.mJournal);
+	mJournalGeneration	 = other.mJournalGeneration;
+	adoptChildren();
+
+	other.mChildren.clear();
+	other.mNamedChildren.clear();
+	other.mOrderedChildren.clear();
+	other.invalidateHash(true);
+	return *this;
+}
+
+void Object::addOwner(Object* owner)
+{
+	if (mOwnerCounts) {
+		++(*mOwnerCounts)[owner];
+		return;
 	}
 
-	return Transform::fromTranslation(delta);
+	mOwners.push_back(owner);
+	if (mOwners.size() > 16) {
+		mOwnerCounts.reset(new std::unordered_map<Object*, size_t>());
+		for (Object* o : mOwners)
+			++(*mOwnerCounts)[o];
+		std::vector<Object*>().swap(mOwners);
+	}
 }
 
-Transform parseTransformScale(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Object::removeOwner(Object* owner)
 {
-	Vector scale;
-	auto uniformScaleA = element->Attribute("value");
-	if (uniformScaleA) {
-		if (!unpackVector(uniformScaleA, ctx.Arguments, &scale, Number(1)))
-			scale = Vector(1, 1, 1);
-	} else {
-		if (!unpackNumber(element->Attribute("x"), ctx.Arguments, &scale.x))
-			scale.x = 1;
-		if (!unpackNumber(element->Attribute("y"), ctx.Arguments, &scale.y))
-			scale.y = 1;
-		if (!unpackNumber(element->Attribute("z"), ctx.Arguments, &scale.z))
-			scale.z = 1;
+	if (mOwnerCounts) {
+		const auto it = mOwnerCounts->find(owner);
+		if (it != mOwnerCounts->end() && --it->second == 0)
+			mOwnerCounts->erase(it);
+		return;
 	}
 
-	return Transform::fromScale(scale);
+	const auto it = std::find(mOwners.begin(), mOwners.end(), owner);
+	if (it != mOwners.end()) {
+		*it = mOwners.back();
+		mOwners.pop_back();
+	}
 }
 
-Transform parseTransformRotate(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Object::adoptChildren()
 {
-	Vector axis;
-	auto value = element->Attribute("axis");
-	if (value) {
-		if (!unpackVector(value, ctx.Arguments, &axis))
-			axis = Vector(0, 0, 1);
-	} else {
-		axis		 = Vector(0, 0, 0);
-		bool hasData = false;
-		if (unpackNumber(element->Attribute("x"), ctx.Arguments, &axis.x))
-			hasData = true;
-		if (unpackNumber(element->Attribute("y"), ctx.Arguments, &axis.y))
-			hasData = true;
-		if (unpackNumber(element->Attribute("z"), ctx.Arguments, &axis.z))
-			hasData = true;
+	for (const auto& child : mChildren)
+		child->addOwner(this);
+	for (const auto& child : mNamedChildren)
+		child.second->addOwner(this);
+}
 
-		if (!hasData)
-			axis = Vector(0, 0, 1);
-	}
+void Object::releaseChildren()
+{
+	for (const auto& child : mChildren)
+		child->removeOwner(this);
+	for (const auto& child : mNamedChildren)
+		child.second->removeOwner(this);
+}
 
-	Number angle;
-	if (!unpackNumber(element->Attribute("angle"), ctx.Arguments, &angle))
-		return Transform::fromIdentity();
+void Object::invalidateHash(bool properties)
+{
+	if (properties)
+		mPropertiesHashValid = false;
 
-	return Transform::fromRotation(axis, angle);
+	// Ancestors of an object without a valid hash have none either
+	if (!mHashValid)
+		return;
+
+	mHashValid = false;
+	for (Object* owner : mOwners)
+		owner->invalidateHash(false);
+	if (mOwnerCounts) {
+		for (const auto& owner : *mOwnerCounts)
+			owner.first->invalidateHash(false);
+	}
 }
 
-Transform parseTransformLookAt(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+uint64_t Object::hash() const
 {
-	Vector origin, target, up;
-	if (!unpackVector(element->Attribute("origin"), ctx.Arguments, &origin))
-		return Transform::fromIdentity();
+	if (mHashValid)
+		return mHash;
+
+	// Unordered containers are combined in an order independent way
+	if (!mPropertiesHashValid) {
+		mPropertiesHash = 0;
+		for (const auto& prop : mProperties)
+			mPropertiesHash += hashCombine(std::hash<std::string>()(prop.first), hashProperty(prop.second));
+		mPropertiesHashValid = true;
+	}
 
-	if (!unpackVector(element->Attribute("target"), ctx.Arguments, &target))
-		return Transform::fromIdentity();
+	uint64_t h = mType;
+	h		   = hashCombine(h, std::hash<std::string>()(mPluginType));
+	h		   = hashCombine(h, std::hash<std::string>()(mID));
+	h		   = hashCombine(h, mPropertiesHash);
 
-	if (!unpackVector(element->Attribute("up"), ctx.Arguments, &up))
-		up = Vector(0, 0, 1);
+	for (const auto& child : mChildren)
+		h = hashCombine(h, child->hash());
 
-	return Transform::fromLookAt(origin, target, up);
+	uint64_t named = 0;
+	for (const auto& child : mNamedChildren)
+		named += hashCombine(std::hash<std::string>()(child.first), child.second->hash());
+
+	mHash	   = hashCombine(h, named);
+	mHashValid = true;
+	return mHash;
 }
 
-Transform parseTransformMatrix(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+void Object::recordProperty(const std::string& key, PropertyType newType)
 {
-	auto value = element->Attribute("value");
-	if (!value)
-		return Transform::fromIdentity();
-
-	const auto valueStr = unpackValues(value, ctx.Arguments);
-	Number tmp[16];
-	auto c = _parseNumber(valueStr, tmp, 16);
+	const auto it = mProperties.find(key);
+	mJournal->mEvents.push_back(ChangeEvent{ CK_PROPERTY, this, key, it == mProperties.end() ? PT_NONE : it->second.type(), newType });
 
-	// Row-Major
-	if (c == 9) {
-		return Transform(Transform::Array{ { tmp[0], tmp[1], tmp[2], Number(0),
-											 tmp[3], tmp[4], tmp[5], Number(0),
-											 tmp[6], tmp[7], tmp[8], Number(0),
-											 Number(0), Number(0), Number(0), Number(1) } });
+	if (mJournalGeneration != mJournal->mGeneration) {
+		mJournalGeneration = mJournal->mGeneration;
+		mJournal->mDirty.push_back(this);
 	}
-#ifndef TPM_NO_EXTENSIONS
-	else if (c == 12) { // Official mitsuba does not support this
-		return Transform(Transform::Array{ { tmp[0], tmp[1], tmp[2], tmp[3],
-											 tmp[4], tmp[5], tmp[6], tmp[7],
-											 tmp[8], tmp[9], tmp[10], tmp[11],
-											 Number(0), Number(0), Number(0), Number(1) } });
-	}
-#endif
-	else if (c == 16) {
-		return Transform(Transform::Array{ { tmp[0], tmp[1], tmp[2], tmp[3],
-											 tmp[4], tmp[5], tmp[6], tmp[7],
-											 tmp[8], tmp[9], tmp[10], tmp[11],
-											 tmp[12], tmp[13], tmp[14], tmp[15] } });
-	}
-
-	return Transform::fromIdentity();
 }
 
-using TransformParseCallback = Transform (*)(const ParseContext&, const tinyxml2::XMLElement*);
+void Object::recordChild(const std::string& key, const std::shared_ptr<Object>& child)
+{
+	mJournal->mEvents.push_back(ChangeEvent{ key.empty() ? CK_ANONYMOUS_CHILD : CK_NAMED_CHILD, this, key, PT_NONE, PT_NONE });
+
+	if (mJournalGeneration != mJournal->mGeneration) {
+		mJournalGeneration = mJournal->mGeneration;
+		mJournal->mDirty.push_back(this);
+	}
+
+	if (child)
+		child->attachJournal(mJournal);
+}
+
+void Object::attachJournal(const std::shared_ptr<ChangeJournal>& journal)
+{
+	// Shared subtrees are already attached
+	if (mJournal == journal)
+		return;
+
+	mJournal		   = journal;
+	mJournalGeneration = 0;
+	for (const auto& child : mChildren)
+		child->attachJournal(journal);
+	for (const auto& child : mNamedChildren)
+		child.second->attachJournal(journal);
+}
+
+void Object::detachJournal(const ChangeJournal* journal)
+{
+	// Subtrees attached to another journal since then stay as they are
+	if (!journal || mJournal.get() != journal)
+		return;
+
+	// Replaced objects might be destroyed before the next drain
+	if (mJournalGeneration == mJournal->mGeneration) {
+		auto& dirty = mJournal->mDirty;
+		dirty.erase(std::remove(dirty.begin(), dirty.end(), this), dirty.end());
+	}
+
+	mJournal.reset();
+	mJournalGeneration = 0;
+	for (const auto& child : mChildren)
+		child->detachJournal(journal);
+	for (const auto& child : mNamedChildren)
+		child.second->detachJournal(journal);
+}
+
+// ------------- Change Journal
+void ChangeJournal::drain(std::vector<ChangeEvent>& events)
+{
+	events.clear();
+	events.swap(mEvents);
+	mDirty.clear();
+	++mGeneration; // Objects listed as dirty before are not anymore
+}
+
+// ------------- Deduplication
+// Objects are deduplicated bottom-up, therefore identical children are already the same instance
+class ObjectDeduplicator {
+public:
+	inline explicit ObjectDeduplicator(DeduplicationReport& report)
+		: mReport(report)
+	{
+	}
+
+	inline std::shared_ptr<Object> intern(const std::shared_ptr<Object>& obj)
+	{
+		++mReport.objectsVisited;
+
+		auto& bucket = mObjects[obj->hash()];
+		for (const auto& other : bucket) {
+			if (isEqual(*other, *obj)) {
+				++mReport.objectsShared;
+				++mReport.objectsSharedPerType[obj->type()];
+				mReport.propertiesShared += obj->properties().size();
+				return other;
+			}
+		}
+
+		bucket.push_back(obj);
+		return obj;
+	}
+
+private:
+	static inline bool isEqual(const Object& a, const Object& b)
+	{
+		return a.type() == b.type()
+			   && a.pluginType() == b.pluginType()
+			   && a.id() == b.id()
+			   && a.properties() == b.properties()
+			   && a.anonymousChildren() == b.anonymousChildren()
+			   && a.namedChildren() == b.namedChildren();
+	}
+
+	DeduplicationReport& mReport;
+	std::unordered_map<uint64_t, std::vector<std::shared_ptr<Object>>> mObjects;
+};
+
+// ------------- Value Pool
+// Values are counted as shared if they were already seen in the current pass
+class ValuePool {
+public:
+	inline void beginPass() { ++mPass; }
+
+	// Returns true if the property was changed. The value of a decoded lazy property lives in the lazy part,
+	// therefore it is replaced by a plain copy first. Lazy properties not decoded yet are left as is
+	inline bool intern(Property& prop, PoolReport& report)
+	{
+		if (prop.type() != PT_SPECTRUM && prop.type() != PT_TRANSFORM)
+			return false;
+
+		bool unwrapped = false;
+		if (prop.mLazy) {
+			if (!prop.isDecoded())
+				return false;
+
+			const Property plain = prop.decoded();
+			if (!plain.isValid())
+				return false;
+
+			prop	  = plain;
+			unwrapped = true;
+		}
+
+		if (prop.type() == PT_SPECTRUM) {
+			++report.spectraVisited;
+			return internSpectrum(prop, report) || unwrapped;
+		} else {
+			++report.transformsVisited;
+			return internTransform(prop, report) || unwrapped;
+		}
+	}
+
+private:
+	struct SpectrumEntry {
+		std::shared_ptr<const Spectrum> Value;
+		size_t Pass;
+	};
+
+	struct TransformEntry {
+		Transform Matrix;
+		std::shared_ptr<const TransformCache> Cache;
+		size_t Pass;
+	};
+
+	inline bool internSpectrum(Property& prop, PoolReport& report)
+	{
+		auto& bucket = mSpectra[hashSpectrum(*prop.mSpectrum)];
+		for (auto& entry : bucket) {
+			if (entry.Value != prop.mSpectrum && !(*entry.Value == *prop.mSpectrum))
+				continue;
+
+			if (entry.Pass == mPass)
+				++report.spectraShared;
+			entry.Pass = mPass;
+
+			if (entry.Value == prop.mSpectrum)
+				return false;
+
+			prop.mSpectrum = entry.Value;
+			return true;
+		}
+
+		bucket.push_back(SpectrumEntry{ prop.mSpectrum, mPass });
+		return false;
+	}
+
+	// The matrix is stored inline, therefore only the cached inverse is shared
+	inline bool internTransform(Property& prop, PoolReport& report)
+	{
+		auto& bucket = mTransforms[hashTransform(prop.mTransform)];
+		for (auto& entry : bucket) {
+			if (!(entry.Matrix == prop.mTransform))
+				continue;
+
+			const bool visited = entry.Pass == mPass;
+			entry.Pass		   = mPass;
+
+			// Without a cached inverse there is nothing to share
+			if (!prop.mTransformCache)
+				return false;
+			if (!entry.Cache) {
+				entry.Cache = prop.mTransformCache;
+				return false;
+			}
+
+			if (visited)
+				++report.transformsShared;
+			if (prop.mTransformCache == entry.Cache)
+				return false;
+
+			prop.mTransformCache = entry.Cache;
+			return true;
+		}
+
+		bucket.push_back(TransformEntry{ prop.mTransform, prop.mTransformCache, mPass });
+		return false;
+	}
+
+	size_t mPass = 0;
+	std::unordered_map<uint64_t, std::vector<SpectrumEntry>> mSpectra;
+	std::unordered_map<uint64_t, std::vector<TransformEntry>> mTransforms;
+};
+
+// ------------- Property
+Transform Property::getTransformInverse(const Transform& def, bool* ok) const
+{
+	if (mLazy)
+		return decoded().getTransformInverse(def, ok);
+
+	if (mType != PT_TRANSFORM) {
+		if (ok)
+			*ok = false;
+		return def;
+	}
+
+	if (mTransformCache) {
+		if (ok)
+			*ok = true;
+		return mTransformCache->inverse;
+	}
+
+	bool invertible;
+	const Transform inv = mTransform.inverse(&invertible);
+	if (ok)
+		*ok = invertible;
+	return invertible ? inv : def;
+}
+
+Transform Property::getTransformNormal(const Transform& def, bool* ok) const
+{
+	if (mLazy)
+		return decoded().getTransformNormal(def, ok);
+
+	if (mType == PT_TRANSFORM && mTransformCache) {
+		if (ok)
+			*ok = true;
+		return mTransformCache->normal;
+	}
+
+	bool invertible;
+	const Transform inv = getTransformInverse(def, &invertible);
+	if (ok)
+		*ok = invertible;
+	return invertible ? inv.transposed() : def;
+}
+
+Property Property::fromTransform(const Transform& v, const std::shared_ptr<const TransformDecomposition>& decomposition)
+{
+	Property p(PT_TRANSFORM);
+	p.mTransform			  = v;
+	p.mTransformDecomposition = decomposition;
+	return p;
+}
+
+Property Property::fromTransform(const Transform& v, const Transform& inverse)
+{
+	Property p(PT_TRANSFORM);
+	p.mTransform	  = v;
+	p.mTransformCache = std::make_shared<const TransformCache>(TransformCache{ inverse, inverse.transposed() });
+	return p;
+}
+
+Property Property::fromTransform(const Transform& v, const Transform& inverse, const std::shared_ptr<const TransformDecomposition>& decomposition)
+{
+	Property p				  = fromTransform(v, inverse);
+	p.mTransformDecomposition = decomposition;
+	return p;
+}
+
+// ------------- Basic Parser
+// Same rules as std::stoll and std::stof, but without exceptions and copies
+inline static bool _parseScalar(const char* str, char** end, Integer* value)
+{
+	errno  = 0;
+	*value = (Integer)std::strtoll(str, end, 10);
+	return *end != str && errno != ERANGE;
+}
+
+inline static bool _parseScalar(const char* str, char** end, float* value)
+{
+	errno  = 0;
+	*value = std::strtof(str, end);
+	return *end != str && errno != ERANGE;
+}
+
+inline static bool _parseScalar(const char* str, char** end, double* value)
+{
+	errno  = 0;
+	*value = std::strtod(str, end);
+	return *end != str && errno != ERANGE;
+}
+
+// Scalars are separated by whitespace or a single punctuation character.
+// Stops at the first invalid entry or if func returns false. Returns the number of parsed scalars
+template <typename T, typename Func>
+inline static size_t _parseScalars(const char* str, Func func)
+{
+	size_t counter = 0;
+	while (*str) {
+		char* end;
+		T value;
+		if (!_parseScalar(str, &end, &value))
+			break;
+
+		++counter;
+		if (!func(value))
+			break;
+
+		str = end;
+		if (std::ispunct(*str))
+			++str;
+	}
+
+	return counter;
+}
+
+template <typename T>
+inline static int _parseScalars(const char* str, T* numbers, int amount)
+{
+	int counter = 0;
+	return (int)_parseScalars<T>(str, [&](T v) {
+		numbers[counter++] = v;
+		return counter < amount;
+	});
+}
+
+inline static int _parseInteger(const std::string& str, Integer* numbers, int amount)
+{
+	return _parseScalars<Integer>(str.c_str(), numbers, amount);
+}
+
+inline static int _parseNumber(const std::string& str, Number* numbers, int amount)
+{
+	return _parseScalars<Number>(str.c_str(), numbers, amount);
+}
+
+static void _parseVersion(const char* v, int& major, int& minor, int& patch)
+{
+	major = 0;
+	minor = 6;
+	patch = 0;
+
+	if (!v)
+		return;
+
+	std::string version = v;
+	const auto s1		= version.find_first_of('.');
+
+	major = std::stoi(version.substr(0, s1));
+
+	if (s1 == std::string::npos) {
+		if (major > 0) {
+			minor = 0;
+			patch = 0;
+		}
+		return;
+	}
+
+	const auto s2 = version.find_first_of('.', s1 + 1);
+	minor		  = std::stoi(version.substr(s1 + 1, s2));
+
+	if (s2 == std::string::npos)
+		return;
+
+	patch = std::stoi(version.substr(s2 + 1));
+}
+
+static inline bool isidentifier(char c)
+{
+	return std::isalnum(c) || c == '_';
+}
+
+static std::string unpackValues(const char* str, const ArgumentContainer& cnt)
+{
+	std::string unpackedStr;
+	for (int i = 0; str[i];) {
+		if (str[i] == '$') {
+			std::string variable;
+			++i;
+			for (; str[i] && isidentifier(str[i]); ++i) {
+				variable += str[i];
+			}
+			if (!variable.empty()) {
+				if (!cnt.count(variable))
+					throw std::runtime_error("Unknown variable " + variable);
+
+				unpackedStr += cnt.at(variable);
+			}
+		} else {
+			unpackedStr += str[i];
+			++i;
+		}
+	}
+	return unpackedStr;
+}
+
+static inline bool unpackInteger(const char* str, const ArgumentContainer& cnt, Integer* value)
+{
+	if (!str)
+		return false;
+
+	const std::string valueStr = unpackValues(str, cnt);
+	return _parseInteger(valueStr, value, 1) == 1;
+}
+
+static inline bool unpackNumber(const char* str, const ArgumentContainer& cnt, Number* value)
+{
+	if (!str)
+		return false;
+
+	const std::string valueStr = unpackValues(str, cnt);
+	return _parseNumber(valueStr, value, 1) == 1;
+}
+
+static inline bool unpackVector(const char* str, const ArgumentContainer& cnt, Vector* value, Number fill = Number(0))
+{
+	if (!str)
+		return false;
+
+	const std::string valueStr = unpackValues(str, cnt);
+	Number tmp[3];
+	auto c = _parseNumber(valueStr, tmp, 3);
+	if (c >= 1) {
+		value->x = tmp[0];
+		value->y = c >= 2 ? tmp[1] : fill;
+		value->z = c >= 3 ? tmp[2] : fill;
+		return true;
+	} else {
+		return false;
+	}
+}
+
+//--------------- ID Container
+// Objects skipped by the object filter are registered with their element and only parsed when referenced
+struct IDEntry {
+	std::shared_ptr<Object> Entity;
+	const tinyxml2::XMLElement* Element = nullptr;
+	ObjectType Type						= OT_SCENE;
+	int Flags							= 0;
+	std::shared_ptr<const ArgumentContainer> Arguments;
+	std::shared_ptr<IDEntry> Root; // Outermost skipped element containing this one, if nested
+	bool Resolving = false;
+};
+
+// Include statements only loaded when a requested id was not found yet
+struct PendingInclude {
+	const tinyxml2::XMLElement* Element;
+	std::shared_ptr<const ArgumentContainer> Arguments;
+};
+
+class IDContainer {
+public:
+	inline void registerID(const std::string& id, const std::shared_ptr<Object>& entity)
+	{
+		auto entry	  = std::make_shared<IDEntry>();
+		entry->Entity = entity;
+		mMap[id]	  = entry;
+	}
+
+	inline void registerDeferred(const std::string& id, const std::shared_ptr<IDEntry>& entry)
+	{
+		mMap[id] = entry;
+	}
+
+	inline bool hasID(const std::string& id) const { return mMap.count(id) > 0; }
+
+	inline std::shared_ptr<IDEntry> entry(const std::string& id) const
+	{
+		return hasID(id) ? mMap.at(id) : nullptr;
+	}
+
+	inline void makeAlias(const std::string& id, const std::string& as)
+	{
+		if (!mMap.count(id))
+			return;
+
+		mMap[as] = mMap.at(id);
+	}
+
+	// Skipped elements point into the document, therefore it has to outlive the loading process
+	inline void keepDocument(const std::shared_ptr<const tinyxml2::XMLDocument>& doc)
+	{
+		mDocuments.push_back(doc);
+	}
+
+	// Parents of objects with an id, the scene itself is not tracked
+	inline void addReferrer(const Object* target, Object* referrer)
+	{
+		if (referrer->type() == OT_SCENE)
+			return;
+
+		// References of an object might be interleaved with the ones of its children, e.g., a shape referencing a texture,
+		// then a nested bsdf referencing it, then the shape again. Objects only reference a few others, so check those
+		auto& targets = mTargets[referrer];
+		if (std::find(targets.begin(), targets.end(), target) != targets.end())
+			return;
+
+		targets.push_back(target);
+		mReferrers[target].push_back(referrer);
+	}
+
+	// Used if a parent got replaced by a structurally identical one
+	inline void replaceReferrer(const Object& from, Object* to)
+	{
+		const auto it = mTargets.find(&from);
+		if (it == mTargets.end())
+			return;
+
+		// The replaced object is destroyed afterwards, its address might be reused
+		const std::vector<const Object*> targets = std::move(it->second);
+		mTargets.erase(it);
+
+		auto& toTargets = mTargets[to];
+		for (const Object* target : targets) {
+			// The replaced parent was just parsed and is the last referrer in the common case
+			auto& list = mReferrers[target];
+			if (!list.empty() && list.back() == &from)
+				list.pop_back();
+			else
+				list.erase(std::remove(list.begin(), list.end(), &from), list.end());
+
+			// The identical replacement references the same objects and is therefore listed already in the common case
+			if (std::find(toTargets.begin(), toTargets.end(), target) == toTargets.end()) {
+				toTargets.push_back(target);
+				list.push_back(to);
+			}
+		}
+	}
+
+	inline const std::unordered_map<std::string, std::shared_ptr<IDEntry>>& entries() const { return mMap; }
+	inline std::unordered_map<const Object*, std::vector<Object*>>& referrers() { return mReferrers; }
+
+	inline void deferInclude(const PendingInclude& include) { mIncludes.push_back(include); }
+	inline bool hasPendingIncludes() const { return mNextInclude < mIncludes.size(); }
+	inline PendingInclude popInclude() { return mIncludes[mNextInclude++]; }
+
+private:
+	std::unordered_map<std::string, std::shared_ptr<IDEntry>> mMap;
+	std::vector<std::shared_ptr<const tinyxml2::XMLDocument>> mDocuments;
+	std::vector<PendingInclude> mIncludes;
+	size_t mNextInclude = 0;
+	std::unordered_map<const Object*, std::vector<Object*>> mReferrers;
+	std::unordered_map<const Object*, std::vector<const Object*>> mTargets; // Inverse of mReferrers
+};
+
+// Object type to parser flag
+#define OT_PF(x) (1 << (x))
+
+enum ParseFlags {
+	PF_BSDF		  = OT_PF(OT_BSDF),
+	PF_EMITTER	  = OT_PF(OT_EMITTER),
+	PF_FILM		  = OT_PF(OT_FILM),
+	PF_INTEGRATOR = OT_PF(OT_INTEGRATOR),
+	PF_MEDIUM	  = OT_PF(OT_MEDIUM),
+	PF_PHASE	  = OT_PF(OT_PHASE),
+	PF_RFILTER	  = OT_PF(OT_RFILTER),
+	PF_SAMPLER	  = OT_PF(OT_SAMPLER),
+	PF_SENSOR	  = OT_PF(OT_SENSOR),
+	PF_SHAPE	  = OT_PF(OT_SHAPE),
+	PF_SUBSURFACE = OT_PF(OT_SUBSURFACE),
+	PF_TEXTURE	  = OT_PF(OT_TEXTURE),
+	PF_VOLUME	  = OT_PF(OT_VOLUME),
+
+	PF_REFERENCE = OT_PF(_OT_COUNT + 0),
+	PF_DEFAULT	 = OT_PF(_OT_COUNT + 1),
+	PF_ALIAS	 = OT_PF(_OT_COUNT + 2),
+	PF_PARAMETER = OT_PF(_OT_COUNT + 3),
+	PF_INCLUDE	 = OT_PF(_OT_COUNT + 4),
+	PF_NULL		 = OT_PF(_OT_COUNT + 5),
+
+	// Compositions extracted from the official schema
+	PF_C_OBJECTGROUP = PF_PARAMETER | PF_DEFAULT,
+	PF_C_BSDF		 = PF_C_OBJECTGROUP | PF_PHASE | PF_TEXTURE | PF_BSDF | PF_REFERENCE,
+	PF_C_EMITTER	 = PF_C_OBJECTGROUP | PF_TEXTURE | PF_EMITTER | PF_MEDIUM | PF_REFERENCE,
+	PF_C_FILM		 = PF_C_OBJECTGROUP | PF_RFILTER,
+	PF_C_INTEGRATOR	 = PF_C_OBJECTGROUP | PF_INTEGRATOR | PF_SAMPLER,
+	PF_C_MEDIUM		 = PF_C_OBJECTGROUP | PF_SHAPE | PF_VOLUME | PF_PHASE,
+	PF_C_PHASE		 = PF_C_OBJECTGROUP | PF_PHASE,
+	PF_C_SAMPLER	 = PF_C_OBJECTGROUP,
+	PF_C_SCENE		 = PF_C_OBJECTGROUP | PF_ALIAS | PF_SENSOR | PF_TEXTURE | PF_BSDF | PF_SUBSURFACE | PF_INTEGRATOR | PF_EMITTER | PF_SHAPE | PF_MEDIUM | PF_PHASE | PF_INCLUDE | PF_NULL,
+	PF_C_SENSOR		 = PF_C_OBJECTGROUP | PF_SENSOR | PF_FILM | PF_MEDIUM | PF_SAMPLER | PF_REFERENCE,
+	PF_C_SHAPE		 = PF_C_OBJECTGROUP | PF_BSDF | PF_SUBSURFACE | PF_SENSOR | PF_EMITTER | PF_SHAPE | PF_MEDIUM | PF_TEXTURE | PF_RFILTER | PF_REFERENCE,
+	PF_C_SUBSURFACE	 = PF_C_OBJECTGROUP | PF_PHASE | PF_BSDF,
+	PF_C_RFILTER	 = PF_C_OBJECTGROUP,
+	PF_C_TEXTURE	 = PF_C_OBJECTGROUP | PF_TEXTURE | PF_RFILTER | PF_REFERENCE,
+	PF_C_VOLUME		 = PF_C_OBJECTGROUP | PF_VOLUME,
+};
+
+// Everything required to decode lazy properties after loading finished
+struct LazyPropertyScope {
+	// Main document and all includes
+	std::vector<std::shared_ptr<const tinyxml2::XMLDocument>> Documents;
+	// Copy of the loader, which might be changed or destroyed after loading
+	SceneLoader Loader;
+	std::string FileDirectory;
+};
+
+// Settings are taken from the loader, only the state of the current element is stored here
+struct ParseContext {
+	inline ParseContext(const TPM_NAMESPACE::ArgumentContainer& arguments, const SceneLoader& loader, const std::string& fileDirectory, bool convertCamelCase)
+		: Arguments(arguments)
+		, Loader(loader)
+		, FileDirectory(fileDirectory)
+		, ConvertCamelCase(convertCamelCase)
+	{
+	}
+
+	// Same context with different arguments, e.g., after a default statement
+	inline ParseContext withArguments(const TPM_NAMESPACE::ArgumentContainer& arguments) const
+	{
+		ParseContext ctx(arguments, Loader, FileDirectory, ConvertCamelCase);
+		ctx.ObjectFilter  = ObjectFilter;
+		ctx.DeferIncludes = DeferIncludes;
+		ctx.Cache		  = Cache;
+		ctx.Deduplicator  = Deduplicator;
+		ctx.Binding		  = Binding;
+		ctx.BoundData	  = BoundData;
+		ctx.Lazy		  = Lazy;
+		return ctx;
+	}
+
+	const TPM_NAMESPACE::ArgumentContainer& Arguments;
+	const SceneLoader& Loader;
+	const std::string& FileDirectory;
+	bool ConvertCamelCase;
+	uint32_t ObjectFilter = OTM_ALL;
+	bool DeferIncludes	  = false;
+
+	// Optional
+	LoadCache* Cache				 = nullptr;
+	ObjectDeduplicator* Deduplicator = nullptr;
+	const PluginBinding* Binding	 = nullptr; // Binding of the object currently parsed
+	void* BoundData					 = nullptr;
+	std::shared_ptr<LazyPropertyScope> Lazy;
+};
+
+static inline std::string resolveContextPath(const ParseContext& ctx, const std::string& path)
+{
+	const auto& lookupPaths = ctx.Loader.lookupPaths();
+	return ctx.Cache ? ctx.Cache->resolve(path, ctx.FileDirectory, lookupPaths) : resolvePath(path, ctx.FileDirectory, lookupPaths);
+}
+
+static inline Property parseInteger(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	Integer value;
+	return unpackInteger(element->Attribute("value"), ctx.Arguments, &value) ? Property::fromInteger(value) : Property();
+}
+
+static inline Property parseFloat(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	Number value;
+	return unpackNumber(element->Attribute("value"), ctx.Arguments, &value) ? Property::fromNumber(value) : Property();
+}
+
+static inline Property parseVector(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	auto attrib = element->Attribute("value");
+	if (!attrib) { // Try legacy way
+		Number x, y, z;
+		if (!unpackNumber(element->Attribute("x"), ctx.Arguments, &x))
+			return Property();
+		if (!unpackNumber(element->Attribute("y"), ctx.Arguments, &y))
+			return Property();
+		if (!unpackNumber(element->Attribute("z"), ctx.Arguments, &z))
+			return Property();
+
+		return Property::fromVector(Vector(x, y, z));
+	} else {
+		Vector v;
+		if (!unpackVector(attrib, ctx.Arguments, &v))
+			return Property();
+
+		return Property::fromVector(v);
+	}
+}
+
+static inline Property parseBool(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	auto attrib = element->Attribute("value");
+	if (!attrib)
+		return Property();
+
+	const auto valueStr = unpackValues(attrib, ctx.Arguments);
+	if (valueStr == "true")
+		return Property::fromBool(true);
+	else if (valueStr == "false")
+		return Property::fromBool(false);
+	else
+		return Property();
+}
+
+static Property parseRGB(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	// TODO
+	auto intent = element->Attribute("intent");
+	(void)intent;
+
+	auto attrib = element->Attribute("value");
+	if (!attrib) { // Try legacy way
+		Number r, g, b;
+		if (!unpackNumber(element->Attribute("r"), ctx.Arguments, &r))
+			return Property();
+		if (!unpackNumber(element->Attribute("g"), ctx.Arguments, &g))
+			return Property();
+		if (!unpackNumber(element->Attribute("b"), ctx.Arguments, &b))
+			return Property();
+
+		return Property::fromColor(Color(r, g, b));
+	} else {
+		Vector v;
+		if (!unpackVector(attrib, ctx.Arguments, &v))
+			return Property();
+
+		return Property::fromColor(Color(v.x, v.y, v.z));
+	}
+}
+
+static Property parseSpectrum(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	auto intent = element->Attribute("intent");
+	(void)intent;
+
+	auto filename = element->Attribute("filename");
+	if (filename) { // Load from .spd files!
+		const std::string unpacked_filename = unpackValues(filename, ctx.Arguments);
+		const std::string full_path			= resolveContextPath(ctx, unpacked_filename);
+
+		if (full_path.empty())
+			throw std::runtime_error("File " + std::string(unpacked_filename) + " not found");
+
+		std::vector<Number> wvls;
+		std::vector<Number> weights;
+		std::ifstream stream(full_path, std::ios::in);
+		std::string line;
+		while (std::getline(stream, line)) {
+			const size_t comment_start = line.find_first_of('#');
+			if (comment_start != std::string::npos)
+				line.resize(comment_start);
+			if (line.empty())
+				continue;
+
+			Number tmp[2];
+			int i = _parseNumber(line, tmp, 2);
+			if (i == 2) {
+				wvls.push_back(tmp[0]);
+				weights.push_back(tmp[1]);
+			}
+		}
+
+		return Property::fromSpectrum(Spectrum(std::move(wvls), std::move(weights)));
+	} else {
+		auto value = element->Attribute("value");
+		if (!value)
+			return Property();
+
+		const auto valueStr = unpackValues(value, ctx.Arguments);
+
+		// Wavelength + Weight pairs are usually given as 'wvl:weight'
+		const size_t expected = std::count(valueStr.begin(), valueStr.end(), ':') + 1;
+		std::vector<Number> wvls;
+		std::vector<Number> weights;
+		wvls.reserve(expected);
+		weights.reserve(expected);
+
+		const size_t c = _parseScalars<Number>(valueStr.c_str(), [&](Number v) {
+			if (wvls.size() == weights.size())
+				wvls.push_back(v);
+			else
+				weights.push_back(v);
+			return true;
+		});
+
+		if (c == 1) {			 // Uniform
+			return Property::fromSpectrum(Spectrum(wvls.front()));
+		} else if (c % 2 == 0) { // Wavelength + Weight pairs
+			return Property::fromSpectrum(Spectrum(std::move(wvls), std::move(weights)));
+		} else {
+			return Property();
+		}
+	}
+}
+
+static Property parseBlackbody(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	Number temp, scale;
+	if (!unpackNumber(element->Attribute("temperature"), ctx.Arguments, &temp))
+		return Property();
+
+	if (!unpackNumber(element->Attribute("scale"), ctx.Arguments, &scale))
+		scale = Number(1);
+
+	return Property::fromBlackbody(Blackbody(temp, scale));
+}
+
+static Property parseString(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	auto attrib = element->Attribute("value");
+	if (!attrib)
+		return Property();
+	return Property::fromString(unpackValues(attrib, ctx.Arguments));
+}
+
+// ---------- Transform Parameter
+// The optional operation is only filled if the element was valid
+Transform parseTransformTranslate(const ParseContext& ctx, const tinyxml2::XMLElement* element, TransformOp* op)
+{
+	Vector delta;
+	auto value = element->Attribute("value");
+	if (value) {
+		if (!unpackVector(value, ctx.Arguments, &delta))
+			delta = Vector(0, 0, 0);
+	} else {
+		if (!unpackNumber(element->Attribute("x"), ctx.Arguments, &delta.x))
+			delta.x = 0;
+		if (!unpackNumber(element->Attribute("y"), ctx.Arguments, &delta.y))
+			delta.y = 0;
+		if (!unpackNumber(element->Attribute("z"), ctx.Arguments, &delta.z))
+			delta.z = 0;
+	}
+
+	if (op) {
+		op->type  = TOT_TRANSLATE;
+		op->value = delta;
+	}
+
+	return Transform::fromTranslation(delta);
+}
+
+Transform parseTransformScale(const ParseContext& ctx, const tinyxml2::XMLElement* element, TransformOp* op)
+{
+	Vector scale;
+	auto uniformScaleA = element->Attribute("value");
+	if (uniformScaleA) {
+		if (!unpackVector(uniformScaleA, ctx.Arguments, &scale, Number(1)))
+			scale = Vector(1, 1, 1);
+	} else {
+		if (!unpackNumber(element->Attribute("x"), ctx.Arguments, &scale.x))
+			scale.x = 1;
+		if (!unpackNumber(element->Attribute("y"), ctx.Arguments, &scale.y))
+			scale.y = 1;
+		if (!unpackNumber(element->Attribute("z"), ctx.Arguments, &scale.z))
+			scale.z = 1;
+	}
+
+	if (op) {
+		op->type  = TOT_SCALE;
+		op->value = scale;
+	}
+
+	return Transform::fromScale(scale);
+}
+
+Transform parseTransformRotate(const ParseContext& ctx, const tinyxml2::XMLElement* element, TransformOp* op)
+{
+	Vector axis;
+	auto value = element->Attribute("axis");
+	if (value) {
+		if (!unpackVector(value, ctx.Arguments, &axis))
+			axis = Vector(0, 0, 1);
+	} else {
+		axis		 = Vector(0, 0, 0);
+		bool hasData = false;
+		if (unpackNumber(element->Attribute("x"), ctx.Arguments, &axis.x))
+			hasData = true;
+		if (unpackNumber(element->Attribute("y"), ctx.Arguments, &axis.y))
+			hasData = true;
+		if (unpackNumber(element->Attribute("z"), ctx.Arguments, &axis.z))
+			hasData = true;
+
+		if (!hasData)
+			axis = Vector(0, 0, 1);
+	}
+
+	Number angle;
+	if (!unpackNumber(element->Attribute("angle"), ctx.Arguments, &angle))
+		return Transform::fromIdentity();
+
+	if (op) {
+		op->type  = TOT_ROTATE;
+		op->value = axis;
+		op->angle = angle;
+	}
+
+	return Transform::fromRotation(axis, angle);
+}
+
+Transform parseTransformLookAt(const ParseContext& ctx, const tinyxml2::XMLElement* element, TransformOp* op)
+{
+	Vector origin, target, up;
+	if (!unpackVector(element->Attribute("origin"), ctx.Arguments, &origin))
+		return Transform::fromIdentity();
+
+	if (!unpackVector(element->Attribute("target"), ctx.Arguments, &target))
+		return Transform::fromIdentity();
+
+	if (!unpackVector(element->Attribute("up"), ctx.Arguments, &up))
+		up = Vector(0, 0, 1);
+
+	if (op) {
+		op->type   = TOT_LOOKAT;
+		op->value  = origin;
+		op->target = target;
+		op->up	   = up;
+	}
+
+	return Transform::fromLookAt(origin, target, up);
+}
+
+Transform parseTransformMatrix(const ParseContext& ctx, const tinyxml2::XMLElement* element, TransformOp*)
+{
+	auto value = element->Attribute("value");
+	if (!value)
+		return Transform::fromIdentity();
+
+	const auto valueStr = unpackValues(value, ctx.Arguments);
+	Number tmp[16];
+	auto c = _parseNumber(valueStr, tmp, 16);
+
+	// Row-Major
+	if (c == 9) {
+		return Transform(Transform::Array{ { tmp[0], tmp[1], tmp[2], Number(0),
+											 tmp[3], tmp[4], tmp[5], Number(0),
+											 tmp[6], tmp[7], tmp[8], Number(0),
+											 Number(0), Number(0), Number(0), Number(1) } });
+	}
+#ifndef TPM_NO_EXTENSIONS
+	else if (c == 12) { // Official mitsuba does not support this
+		return Transform(Transform::Array{ { tmp[0], tmp[1], tmp[2], tmp[3],
+											 tmp[4], tmp[5], tmp[6], tmp[7],
+											 tmp[8], tmp[9], tmp[10], tmp[11],
+											 Number(0), Number(0), Number(0), Number(1) } });
+	}
+#endif
+	else if (c == 16) {
+		return Transform(Transform::Array{ { tmp[0], tmp[1], tmp[2], tmp[3],
+											 tmp[4], tmp[5], tmp[6], tmp[7],
+											 tmp[8], tmp[9], tmp[10], tmp[11],
+											 tmp[12], tmp[13], tmp[14], tmp[15] } });
+	}
+
+	return Transform::fromIdentity();
+}
+
+using TransformParseCallback = Transform (*)(const ParseContext&, const tinyxml2::XMLElement*, TransformOp*);
 struct {
 	const char* Name;
-	TransformParseCallback Callback;
-} _transformParseElements[] = {
-	{ "translate", parseTransformTranslate },
-	{ "scale", parseTransformScale },
-	{ "rotate", parseTransformRotate },
-	{ "lookAt", parseTransformLookAt },
-	{ "lookat", parseTransformLookAt },
-	{ "matrix", parseTransformMatrix },
-	{ nullptr, nullptr }
+	TransformParseCallback Callback;
+} _transformParseElements[] = {
+	{ "translate", parseTransformTranslate },
+	{ "scale", parseTransformScale },
+	{ "rotate", parseTransformRotate },
+	{ "lookAt", parseTransformLookAt },
+	{ "lookat", parseTransformLookAt },
+	{ "matrix", parseTransformMatrix },
+	{ nullptr, nullptr }
+};
+
+// Apply the operation from the left to the decomposition, as long as the result is a TRS
+static void appendToTRS(TransformDecomposition& decomposition, const TransformOp& op)
+{
+	if (!decomposition.isTRS)
+		return;
+
+	TransformTRS& trs = decomposition.trs;
+	switch (op.type) {
+	case TOT_TRANSLATE:
+		trs.translation = Vector(trs.translation.x + op.value.x, trs.translation.y + op.value.y, trs.translation.z + op.value.z);
+		break;
+	case TOT_ROTATE: {
+		const auto q	= Quaternion::fromRotation(op.value, op.angle);
+		trs.translation = q.rotate(trs.translation);
+		trs.rotation	= q * trs.rotation;
+	} break;
+	case TOT_SCALE: {
+		// Non-uniform scales only commute with the identity rotation, otherwise shear is introduced
+		const bool uniform = op.value.x == op.value.y && op.value.y == op.value.z;
+		if (!uniform && trs.rotation != Quaternion::fromIdentity()) {
+			decomposition.isTRS = false;
+			break;
+		}
+		trs.translation = Vector(trs.translation.x * op.value.x, trs.translation.y * op.value.y, trs.translation.z * op.value.z);
+		trs.scale		= Vector(trs.scale.x * op.value.x, trs.scale.y * op.value.y, trs.scale.z * op.value.z);
+	} break;
+	case TOT_LOOKAT: {
+		// Only a proper rotation (no reflection) with a translation
+		const auto& m	 = op.matrix;
+		const Number det = m(0, 0) * (m(1, 1) * m(2, 2) - m(1, 2) * m(2, 1))
+						   - m(0, 1) * (m(1, 0) * m(2, 2) - m(1, 2) * m(2, 0))
+						   + m(0, 2) * (m(1, 0) * m(2, 1) - m(1, 1) * m(2, 0));
+		if (det <= 0) {
+			decomposition.isTRS = false;
+			break;
+		}
+		const auto q	= Quaternion::fromMatrix(m);
+		const auto t	= q.rotate(trs.translation);
+		trs.translation = Vector(t.x + op.value.x, t.y + op.value.y, t.z + op.value.z);
+		trs.rotation	= q * trs.rotation;
+	} break;
+	default:
+		// Invalid elements are ignored and result in the identity as well
+		if (op.matrix != Transform::fromIdentity())
+			decomposition.isTRS = false;
+		break;
+	}
+}
+
+Transform parseInnerMatrix(const ParseContext& ctx, const tinyxml2::XMLElement* element, TransformDecomposition* decomposition = nullptr)
+{
+	Transform inner = Transform::fromIdentity();
+	for (auto childElement = element->FirstChildElement();
+		 childElement;
+		 childElement = childElement->NextSiblingElement()) {
+
+		for (int i = 0; _transformParseElements[i].Name; ++i) {
+			if (strcmp(childElement->Name(), _transformParseElements[i].Name) == 0) {
+				if (decomposition) {
+					TransformOp op;
+					op.matrix = _transformParseElements[i].Callback(ctx, childElement, &op);
+					inner	  = op.matrix * inner;
+					appendToTRS(*decomposition, op);
+					decomposition->operations.push_back(op);
+				} else {
+					inner = _transformParseElements[i].Callback(ctx, childElement, nullptr) * inner;
+				}
+				break;
+			}
+		}
+	}
+
+	return inner;
+}
+
+static Property parseTransform(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	std::shared_ptr<TransformDecomposition> decomposition;
+	if (ctx.Loader.isTransformDecompositionEnabled())
+		decomposition = std::make_shared<TransformDecomposition>();
+
+	const auto transform = parseInnerMatrix(ctx, element, decomposition.get());
+
+	// Singular transforms are not cached, so the getters report the failure the same way as without caching
+	if (ctx.Loader.isTransformInverseCachingEnabled()) {
+		bool invertible;
+		const auto inverse = transform.inverse(&invertible);
+		if (invertible)
+			return Property::fromTransform(transform, inverse, decomposition);
+	}
+
+	return Property::fromTransform(transform, decomposition);
+}
+
+static Property parseAnimation(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	Animation anim;
+	for (auto childElement = element->FirstChildElement();
+		 childElement;
+		 childElement = childElement->NextSiblingElement()) {
+		if (strcmp(childElement->Name(), "transform") != 0)
+			throw std::runtime_error("Animation entries are only of type transform");
+
+		Number time;
+		if (!unpackNumber(childElement->Attribute("time"), ctx.Arguments, &time))
+			throw std::runtime_error("Animation entry missing time attribute");
+
+		anim.addKeyFrame(time, parseInnerMatrix(ctx, childElement));
+	}
+
+	return Property::fromAnimation(anim);
+}
+
+using PropertyParseCallback = Property (*)(const ParseContext&, const tinyxml2::XMLElement*);
+
+static const struct {
+	const char* Name;
+	PropertyType Type;
+	PropertyParseCallback Callback;
+} _propertyParseElement[] = {
+	{ "integer", PT_INTEGER, parseInteger },
+	{ "float", PT_NUMBER, parseFloat },
+	{ "vector", PT_VECTOR, parseVector },
+	{ "point", PT_VECTOR, parseVector },
+	{ "boolean", PT_BOOL, parseBool },
+	{ "string", PT_STRING, parseString },
+	{ "rgb", PT_COLOR, parseRGB },
+	{ "spectrum", PT_SPECTRUM, parseSpectrum },
+	{ "blackbody", PT_BLACKBODY, parseBlackbody },
+	{ "transform", PT_TRANSFORM, parseTransform },
+	{ "animation", PT_ANIMATION, parseAnimation },
+	{ nullptr, PT_NONE, nullptr }
+};
+
+// Returns -1 if the element is not a property
+static inline int findPropertyParser(const tinyxml2::XMLElement* element)
+{
+	if (!element->Attribute("name"))
+		return -1;
+
+	for (int i = 0; _propertyParseElement[i].Name; ++i) {
+		if (strcmp(element->Name(), _propertyParseElement[i].Name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+// Returns false if the element is not a property
+static bool parseProperty(const ParseContext& ctx, const tinyxml2::XMLElement* element, std::string& name, Property& prop)
+{
+	const int parser = findPropertyParser(element);
+	if (parser < 0)
+		return false;
+
+	name = convertCC(element->Attribute("name"), ctx.ConvertCamelCase);
+	prop = _propertyParseElement[parser].Callback(ctx, element);
+	return true;
+}
+
+// ------------- Lazy Property
+struct LazyProperty {
+	inline LazyProperty(const std::shared_ptr<const LazyPropertyScope>& scope, const std::shared_ptr<const ArgumentContainer>& arguments,
+						const tinyxml2::XMLElement* element, PropertyParseCallback callback)
+		: Scope(scope)
+		, Arguments(arguments)
+		, Element(element)
+		, Callback(callback)
+		, Decoded(false)
+	{
+	}
+
+	std::shared_ptr<const LazyPropertyScope> Scope;
+	std::shared_ptr<const ArgumentContainer> Arguments;
+	const tinyxml2::XMLElement* Element;
+	PropertyParseCallback Callback;
+
+	std::once_flag Once;
+	std::atomic<bool> Decoded;
+	std::unique_ptr<const Property> Value; // Only allocated on first access
+};
+
+Property Property::fromLazy(PropertyType type, const std::shared_ptr<LazyProperty>& lazy)
+{
+	Property p(type);
+	p.mLazy = lazy;
+	return p;
+}
+
+bool Property::isDecoded() const
+{
+	return !mLazy || mLazy->Decoded.load(std::memory_order_acquire);
+}
+
+const Property& Property::decoded() const
+{
+	LazyProperty& lazy = *mLazy;
+	std::call_once(lazy.Once, [&]() {
+		const auto& scope = *lazy.Scope;
+		const ParseContext ctx(*lazy.Arguments, scope.Loader, scope.FileDirectory, false);
+
+		// Errors (e.g., missing spectrum files) make the property invalid instead of escaping from a getter
+		Property value;
+		try {
+			value = lazy.Callback(ctx, lazy.Element);
+		} catch (const std::exception&) {
+			value = Property();
+		}
+		lazy.Value.reset(new Property(std::move(value)));
+		lazy.Decoded.store(true, std::memory_order_release);
+	});
+	return *lazy.Value;
+}
+
+// Only the name is decoded, the value is parsed on first access.
+// Small values are decoded immediately, as a lazy property would take more memory than the value itself
+static inline bool parseLazyProperty(const ParseContext& ctx, const tinyxml2::XMLElement* element,
+									 std::shared_ptr<const ArgumentContainer>& arguments, std::string& name, Property& prop)
+{
+	const int parser = findPropertyParser(element);
+	if (parser < 0)
+		return false;
+
+	const PropertyType type			  = _propertyParseElement[parser].Type;
+	const PropertyParseCallback parse = _propertyParseElement[parser].Callback;
+	name							  = convertCC(element->Attribute("name"), ctx.ConvertCamelCase);
+
+	if (type != PT_SPECTRUM && type != PT_TRANSFORM && type != PT_ANIMATION) {
+		prop = parse(ctx, element);
+		return true;
+	}
+
+	if (!arguments)
+		arguments = std::make_shared<const ArgumentContainer>(ctx.Arguments);
+
+	prop = Property::fromLazy(type, std::make_shared<LazyProperty>(ctx.Lazy, arguments, element, parse));
+	return true;
+}
+
+// Returns false if the property type does not match the field
+static bool writeBoundField(void* data, const FieldBinding& field, const Property& prop)
+{
+	if (prop.type() != field.type)
+		return false;
+
+	void* ptr = static_cast<char*>(data) + field.offset;
+	switch (field.type) {
+	case PT_ANIMATION:
+		*static_cast<Animation*>(ptr) = prop.getAnimation();
+		break;
+	case PT_BLACKBODY:
+		*static_cast<Blackbody*>(ptr) = prop.getBlackbody();
+		break;
+	case PT_BOOL:
+		*static_cast<bool*>(ptr) = prop.getBool();
+		break;
+	case PT_INTEGER:
+		*static_cast<Integer*>(ptr) = prop.getInteger();
+		break;
+	case PT_NUMBER:
+		*static_cast<Number*>(ptr) = prop.getNumber();
+		break;
+	case PT_COLOR:
+		*static_cast<Color*>(ptr) = prop.getColor();
+		break;
+	case PT_SPECTRUM:
+		*static_cast<Spectrum*>(ptr) = prop.getSpectrum();
+		break;
+	case PT_STRING:
+		*static_cast<std::string*>(ptr) = prop.getString();
+		break;
+	case PT_TRANSFORM:
+		*static_cast<Transform*>(ptr) = prop.getTransform();
+		break;
+	case PT_VECTOR:
+		*static_cast<Vector*>(ptr) = prop.getVector();
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+// The arguments are shared by all lazy properties until the next default statement
+bool parseParameter(Object* obj, const ParseContext& ctx, const tinyxml2::XMLElement* element, std::shared_ptr<const ArgumentContainer>& arguments)
+{
+	std::string name;
+	Property prop;
+
+	// Bound fields have to be written immediately
+	if (ctx.Lazy && !ctx.Binding) {
+		if (!parseLazyProperty(ctx, element, arguments, name, prop))
+			return false;
+
+		if (prop.isValid())
+			obj->setProperty(name, prop);
+		return true;
+	}
+
+	if (!parseProperty(ctx, element, name, prop))
+		return false;
+
+	if (!prop.isValid())
+		return true;
+
+	// Bound fields are not added to the object
+	if (ctx.Binding) {
+		for (const auto& field : ctx.Binding->fields) {
+			if (name == field.name && writeBoundField(ctx.BoundData, field, prop))
+				return true;
+		}
+	}
+
+	obj->setProperty(name, prop);
+	return true;
+}
+
+static bool findID(const ParseContext& ctx, IDContainer& ids, const std::string& id);
+static void handleAlias(const ParseContext& ctx, IDContainer& idcontainer, const tinyxml2::XMLElement* element)
+{
+	auto id = element->Attribute("id");
+	auto as = element->Attribute("as");
+
+	if (!id || !as)
+		throw std::runtime_error("Invalid alias element");
+
+	if (!findID(ctx, idcontainer, id))
+		throw std::runtime_error("Unknown id " + std::string(id));
+
+	if (idcontainer.hasID(as))
+		throw std::runtime_error("Id " + std::string(as) + " already existent");
+
+	idcontainer.makeAlias(id, as);
+}
+
+static void handleDefault(ArgumentContainer& cnt, const tinyxml2::XMLElement* element)
+{
+	auto name  = element->Attribute("name");
+	auto value = element->Attribute("value");
+
+	if (!name || !value)
+		throw std::runtime_error("Invalid default element");
+
+	if (!cnt.count(name))
+		cnt[name] = value;
+}
+
+static std::shared_ptr<Object> resolveID(const ParseContext& ctx, IDContainer& ids, const std::string& id);
+static void handleReference(Object* obj, const ParseContext& ctx, IDContainer& ids, const tinyxml2::XMLElement* element, int flags)
+{
+	auto id	  = element->Attribute("id");
+	auto name = element->Attribute("name");
+
+	if (!id)
+		throw std::runtime_error("Invalid ref element");
+
+	const auto ref_id = unpackValues(id, ctx.Arguments);
+
+	auto ref = resolveID(ctx, ids, ref_id);
+	if (!ref)
+		throw std::runtime_error("Id " + ref_id + " does not exists");
+
+	if (flags & OT_PF(obj->type())) {
+		ids.addReferrer(ref.get(), obj);
+		if (name)
+			obj->addNamedChild(convertCC(name, ctx.ConvertCamelCase), ref);
+		else
+			obj->addAnonymousChild(ref);
+	} else {
+		throw std::runtime_error("Id " + ref_id + " not of allowed type");
+	}
+}
+
+static std::shared_ptr<const tinyxml2::XMLDocument> loadInclude(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+{
+	auto filename = element->Attribute("filename");
+	if (!filename)
+		throw std::runtime_error("Invalid include element");
+
+	const std::string unpacked_filename = unpackValues(filename, ctx.Arguments);
+	const std::string full_path			= resolveContextPath(ctx, unpacked_filename);
+
+	if (full_path.empty())
+		throw std::runtime_error("File " + std::string(unpacked_filename) + " not found");
+
+	// Load xml
+	std::shared_ptr<const tinyxml2::XMLDocument> xml;
+	if (ctx.Cache) {
+		xml = ctx.Cache->document(full_path);
+	} else {
+		auto doc = std::make_shared<tinyxml2::XMLDocument>();
+		doc->LoadFile(full_path.c_str());
+		xml = doc;
+	}
+
+	if (xml->Error())
+		throw std::runtime_error(xml->ErrorStr());
+
+	const auto rootScene = xml->RootElement();
+	if (strcmp(rootScene->Name(), "scene") != 0)
+		throw std::runtime_error("Expected root element to be 'scene'");
+
+	// Ignore version
+	return xml;
+}
+
+static void parseObject(Object*, const ParseContext&, IDContainer&, const tinyxml2::XMLElement*, int);
+static void handleInclude(Object* obj, const ParseContext& ctx, IDContainer& ids,
+						  const tinyxml2::XMLElement* element)
+{
+	// TODO: Any default statement inside a include is not visible in the parent scope. But should that not be the case?
+	const auto xml = loadInclude(ctx, element);
+
+	// Parse as scene
+	parseObject(obj, ctx, ids, xml->RootElement(), PF_C_SCENE);
+
+	if (ctx.ObjectFilter != OTM_ALL)
+		ids.keepDocument(xml);
+	if (ctx.Lazy)
+		ctx.Lazy->Documents.push_back(xml);
+}
+
+static const struct {
+	const char* Name;
+	ObjectType Type;
+	int Flags;
+} _parseElements[] = {
+	{ "bsdf", OT_BSDF, PF_C_BSDF },
+	{ "emitter", OT_EMITTER, PF_C_EMITTER },
+	{ "film", OT_FILM, PF_C_FILM },
+	{ "integrator", OT_INTEGRATOR, PF_C_INTEGRATOR },
+	{ "medium", OT_MEDIUM, PF_C_MEDIUM },
+	{ "phase", OT_PHASE, PF_C_PHASE },
+	{ "sampler", OT_SAMPLER, PF_C_SAMPLER },
+	{ "sensor", OT_SENSOR, PF_C_SENSOR },
+	{ "shape", OT_SHAPE, PF_C_SHAPE },
+	{ "subsurface", OT_SUBSURFACE, PF_C_SUBSURFACE },
+	{ "rfilter", OT_RFILTER, PF_C_RFILTER },
+	{ "texture", OT_TEXTURE, PF_C_TEXTURE },
+	{ "volume", OT_VOLUME, PF_C_VOLUME },
+	{ nullptr, ObjectType(0), 0 }
+};
+
+// Index into _parseElements or -1 if the element is not an object allowed by the flags
+static int findObjectElement(const tinyxml2::XMLElement* element, int flags)
+{
+	for (int i = 0; _parseElements[i].Name; ++i) {
+		if ((OT_PF(_parseElements[i].Type) & flags)
+			&& strcmp(element->Name(), _parseElements[i].Name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+// Register skipped objects nested inside a skipped object, as they might be referenced later on
+static void deferNestedObjects(IDContainer& ids, const tinyxml2::XMLElement* element, int flags, const std::shared_ptr<IDEntry>& root)
+{
+	for (auto childElement = element->FirstChildElement();
+		 childElement;
+		 childElement = childElement->NextSiblingElement()) {
+		const int i = findObjectElement(childElement, flags);
+		if (i < 0)
+			continue;
+
+		auto id = childElement->Attribute("id");
+		if (id && !ids.hasID(id)) {
+			auto entry	   = std::make_shared<IDEntry>();
+			entry->Element = childElement;
+			entry->Type	   = _parseElements[i].Type;
+			entry->Flags   = _parseElements[i].Flags;
+			entry->Root	   = root;
+			ids.registerDeferred(id, entry);
+		}
+
+		deferNestedObjects(ids, childElement, _parseElements[i].Flags, root);
+	}
+}
+
+static void deferObject(IDContainer& ids, const tinyxml2::XMLElement* element, ObjectType type, int flags,
+						const std::shared_ptr<const ArgumentContainer>& arguments)
+{
+	auto entry		 = std::make_shared<IDEntry>();
+	entry->Element	 = element;
+	entry->Type		 = type;
+	entry->Flags	 = flags;
+	entry->Arguments = arguments;
+
+	auto id = element->Attribute("id");
+	if (id && !ids.hasID(id))
+		ids.registerDeferred(id, entry);
+
+	deferNestedObjects(ids, element, flags, entry);
+}
+
+static std::shared_ptr<Object> parseChildObject(const ParseContext& ctx, IDContainer& ids, const tinyxml2::XMLElement* element, ObjectType type, int flags)
+{
+	auto pluginType = element->Attribute("type");
+	auto id			= element->Attribute("id");
+	auto child		= std::make_shared<Object>(type, pluginType ? pluginType : "", id ? id : "");
+
+	ParseContext childCtx = ctx;
+	childCtx.Binding	  = ctx.Loader.pluginBinding(type, child->pluginType());
+	childCtx.BoundData	  = childCtx.Binding ? childCtx.Binding->attach(*child) : nullptr;
+
+	parseObject(child.get(), childCtx, ids, element, flags);
+	return child;
+}
+
+static void materializeEntry(const ParseContext& ctx, IDContainer& ids, const std::shared_ptr<IDEntry>& entry)
+{
+	// Nested entries are registered while parsing the outermost skipped element
+	if (entry->Root) {
+		materializeEntry(ctx, ids, entry->Root);
+		return;
+	}
+
+	if (entry->Entity)
+		return;
+
+	if (entry->Resolving)
+		throw std::runtime_error("Cyclic reference detected");
+
+	// Referenced objects are always parsed completely
+	ParseContext deferredCtx  = ctx.withArguments(*entry->Arguments);
+	deferredCtx.ObjectFilter  = OTM_ALL;
+	deferredCtx.DeferIncludes = false;
+
+	entry->Resolving = true;
+	entry->Entity	 = parseChildObject(deferredCtx, ids, entry->Element, entry->Type, entry->Flags);
+	entry->Resolving = false;
+}
+
+static void loadPendingInclude(const ParseContext& ctx, IDContainer& ids)
+{
+	const auto include = ids.popInclude();
+
+	ParseContext includeCtx	 = ctx.withArguments(*include.Arguments);
+	includeCtx.ObjectFilter	 = 0;
+	includeCtx.DeferIncludes = true;
+	includeCtx.Binding		 = nullptr;
+	includeCtx.BoundData	 = nullptr;
+
+	// Only the ids are of interest, scene parameters of the include are dropped
+	Object sink(OT_SCENE, "", "");
+	handleInclude(&sink, includeCtx, ids, include.Element);
+}
+
+static bool findID(const ParseContext& ctx, IDContainer& ids, const std::string& id)
+{
+	while (!ids.hasID(id) && ids.hasPendingIncludes())
+		loadPendingInclude(ctx, ids);
+	return ids.hasID(id);
+}
+
+static std::shared_ptr<Object> resolveID(const ParseContext& ctx, IDContainer& ids, const std::string& id)
+{
+	if (!findID(ctx, ids, id))
+		return nullptr;
+
+	auto entry = ids.entry(id);
+
+	if (!entry->Entity && entry->Element)
+		materializeEntry(ctx, ids, entry);
+
+	return entry->Entity;
+}
+
+// Element dispatch shared by loading and walking. The sink either builds objects (ObjectBuilder) or reports them (HandlerSink).
+// Default statements are applied to a copy of the arguments, which the sink sees via the given context
+template <typename Sink>
+static void dispatchElements(const ParseContext& ctx, const tinyxml2::XMLElement* element, int flags, Sink& sink)
+{
+	// Copy container to make sure recursive elements do not overwrite it
+	ArgumentContainer cnt	   = ctx.Arguments;
+	const ParseContext nextCtx = ctx.withArguments(cnt);
+
+	for (auto childElement = element->FirstChildElement();
+		 childElement;
+		 childElement = childElement->NextSiblingElement()) {
+
+		if ((flags & PF_PARAMETER) && sink.parameter(nextCtx, childElement))
+			continue;
+
+		if ((flags & PF_REFERENCE) && strcmp(childElement->Name(), "ref") == 0) {
+			sink.reference(ctx, childElement, flags);
+		} else if ((flags & PF_DEFAULT) && strcmp(childElement->Name(), "default") == 0) {
+			handleDefault(cnt, childElement);
+			sink.defaults();
+		} else if ((flags & PF_INCLUDE) && strcmp(childElement->Name(), "include") == 0) {
+			sink.include(nextCtx, childElement);
+		} else if ((flags & PF_ALIAS) && strcmp(childElement->Name(), "alias") == 0) {
+			sink.alias(nextCtx, childElement);
+		} else if ((flags & PF_NULL) && strcmp(childElement->Name(), "null") == 0) {
+			// Handle null
+		} else {
+			const int index = findObjectElement(childElement, flags);
+			if (index < 0) {
+				std::stringstream stream;
+				stream << "Found invalid tag '" << childElement->Name() << "'";
+				throw std::runtime_error(stream.str());
+			}
+
+			sink.object(nextCtx, childElement, _parseElements[index].Type, _parseElements[index].Flags);
+		}
+	}
+}
+
+class ObjectBuilder {
+public:
+	inline ObjectBuilder(Object* obj, IDContainer& ids)
+		: mObject(obj)
+		, mIDs(ids)
+	{
+	}
+
+	inline bool parameter(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+	{
+		return parseParameter(mObject, ctx, element, mDeferredArguments);
+	}
+
+	inline void reference(const ParseContext& ctx, const tinyxml2::XMLElement* element, int flags)
+	{
+		handleReference(mObject, ctx, mIDs, element, flags);
+	}
+
+	inline void defaults() { mDeferredArguments.reset(); }
+
+	inline void include(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+	{
+		if (ctx.DeferIncludes)
+			mIDs.deferInclude(PendingInclude{ element, deferredArguments(ctx) });
+		else
+			handleInclude(mObject, ctx, mIDs, element);
+	}
+
+	inline void alias(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+	{
+		handleAlias(ctx, mIDs, element);
+	}
+
+	void object(const ParseContext& ctx, const tinyxml2::XMLElement* element, ObjectType type, int flags)
+	{
+		if (!(ctx.ObjectFilter & OT_PF(type))) {
+			deferObject(mIDs, element, type, flags, deferredArguments(ctx));
+			return;
+		}
+
+		// Might be parsed already if it was skipped beforehand and referenced
+		std::shared_ptr<Object> child;
+		auto id = element->Attribute("id");
+		if (id) {
+			auto entry = mIDs.entry(id);
+			if (entry && entry->Element == element && entry->Entity)
+				child = entry->Entity;
+		}
+
+		if (!child) {
+			child = parseChildObject(ctx, mIDs, element, type, flags);
+			if (ctx.Deduplicator && !child->hasID() && !child->hasBoundData()) {
+				auto shared = ctx.Deduplicator->intern(child);
+				if (shared != child)
+					mIDs.replaceReferrer(*child, shared.get());
+				child = shared;
+			}
+		}
+
+		if (child->hasID()) {
+			auto entry = mIDs.entry(child->id());
+			if (!entry) {
+				mIDs.registerID(child->id(), child);
+			} else if (entry->Element == element) {
+				entry->Entity = child;
+			} else {
+				// TODO: Warning
+			}
+			mIDs.addReferrer(child.get(), mObject);
+		}
+
+		auto name = element->Attribute("name");
+		if (name)
+			mObject->addNamedChild(convertCC(name, ctx.ConvertCamelCase), child);
+		else
+			mObject->addAnonymousChild(child);
+	}
+
+private:
+	// Arguments shared by all skipped objects, includes and lazy properties until the next default statement
+	inline const std::shared_ptr<const ArgumentContainer>& deferredArguments(const ParseContext& ctx)
+	{
+		if (!mDeferredArguments)
+			mDeferredArguments = std::make_shared<const ArgumentContainer>(ctx.Arguments);
+		return mDeferredArguments;
+	}
+
+	Object* mObject;
+	IDContainer& mIDs;
+	std::shared_ptr<const ArgumentContainer> mDeferredArguments;
+};
+
+static void parseObject(Object* obj, const ParseContext& ctx, IDContainer& ids, const tinyxml2::XMLElement* element, int flags)
+{
+	ObjectBuilder builder(obj, ids);
+	dispatchElements(ctx, element, flags, builder);
+}
+
+// ------------- Handler
+static void walkObject(const ParseContext& ctx, SceneHandler& handler, const tinyxml2::XMLElement* element, int flags);
+
+// Same dispatch as loading, but only reports the content to the handler
+class HandlerSink {
+public:
+	inline explicit HandlerSink(SceneHandler& handler)
+		: mHandler(handler)
+	{
+	}
+
+	inline bool parameter(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+	{
+		if (!parseProperty(ctx, element, mPropertyName, mProperty))
+			return false;
+
+		if (mProperty.isValid())
+			mHandler.onProperty(mPropertyName, mProperty);
+		return true;
+	}
+
+	inline void reference(const ParseContext& ctx, const tinyxml2::XMLElement* element, int)
+	{
+		auto id	  = element->Attribute("id");
+		auto name = element->Attribute("name");
+		if (!id)
+			throw std::runtime_error("Invalid ref element");
+
+		mHandler.onReference(unpackValues(id, ctx.Arguments), name ? convertCC(name, ctx.ConvertCamelCase) : std::string());
+	}
+
+	inline void defaults() {}
+
+	inline void include(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+	{
+		const auto xml = loadInclude(ctx, element);
+		walkObject(ctx, mHandler, xml->RootElement(), PF_C_SCENE);
+	}
+
+	inline void alias(const ParseContext&, const tinyxml2::XMLElement* element)
+	{
+		auto id = element->Attribute("id");
+		auto as = element->Attribute("as");
+		if (!id || !as)
+			throw std::runtime_error("Invalid alias element");
+
+		mHandler.onAlias(id, as);
+	}
+
+	inline void object(const ParseContext& ctx, const tinyxml2::XMLElement* element, ObjectType type, int flags)
+	{
+		auto pluginType = element->Attribute("type");
+		auto id			= element->Attribute("id");
+		auto name		= element->Attribute("name");
+
+		mHandler.onObjectBegin(type, pluginType ? pluginType : "", id ? id : "",
+							   name ? convertCC(name, ctx.ConvertCamelCase) : std::string());
+		walkObject(ctx, mHandler, element, flags);
+		mHandler.onObjectEnd(type);
+	}
+
+private:
+	SceneHandler& mHandler;
+	std::string mPropertyName;
+	Property mProperty;
+};
+
+static void walkObject(const ParseContext& ctx, SceneHandler& handler, const tinyxml2::XMLElement* element, int flags)
+{
+	HandlerSink sink(handler);
+	dispatchElements(ctx, element, flags, sink);
+}
+
+class InternalSceneLoader {
+public:
+	static Scene loadFromXML(const SceneLoader& loader, const std::shared_ptr<const tinyxml2::XMLDocument>& xml,
+							 const std::string& fileDirectory, LoadCache* cache)
+	{
+		const auto rootScene = getRootScene(*xml);
+
+		Scene scene;
+		IDContainer idcontainer;
+		ObjectDeduplicator deduplicator(scene.mDeduplicationReport);
+
+		parseVersion(rootScene, scene);
+
+		const bool convertFromCamelCase = !loader.mDisableLowerCaseConversion && (scene.mVersionMajor == 0);
+		ParseContext ctx(loader.mArguments, loader, fileDirectory, convertFromCamelCase);
+		ctx.ObjectFilter = loader.mObjectFilter;
+		ctx.Cache		 = cache;
+		ctx.Deduplicator = loader.mDeduplicate ? &deduplicator : nullptr;
+		ctx.Lazy		 = loader.mLazyProperties ? createLazyScope(loader, xml, fileDirectory) : nullptr;
+		parseObject(&scene, ctx, idcontainer, rootScene, PF_C_SCENE);
+
+		// Skipped objects which were never referenced are not available
+		for (const auto& entry : idcontainer.entries()) {
+			if (entry.second->Entity)
+				scene.mIDs[entry.first] = entry.second->Entity;
+		}
+		scene.mReferrers = std::move(idcontainer.referrers());
+		buildIndices(scene);
+		if (loader.mParentLinks)
+			linkParents(scene);
+		if (loader.mPoolValues)
+			scene.poolValues();
+
+		// Lazy properties would be decoded by hashing
+		if (!loader.mLazyProperties)
+			(void)scene.hash();
+
+		return scene;
+	}
+
+	static std::shared_ptr<Object> loadObjectFromXML(const SceneLoader& loader, const tinyxml2::XMLDocument& xml,
+													 const std::string& fileDirectory, const std::string& id)
+	{
+		const auto rootScene = getRootScene(xml);
+
+		Scene scene;
+		IDContainer idcontainer;
+
+		parseVersion(rootScene, scene);
+
+		// Skip all objects and includes, which are only parsed if required by the requested object
+		const bool convertFromCamelCase = !loader.mDisableLowerCaseConversion && (scene.mVersionMajor == 0);
+		ParseContext ctx(loader.mArguments, loader, fileDirectory, convertFromCamelCase);
+		ctx.ObjectFilter  = 0;
+		ctx.DeferIncludes = true;
+		parseObject(&scene, ctx, idcontainer, rootScene, PF_C_SCENE);
+
+		auto obj = resolveID(ctx, idcontainer, id);
+		if (!obj)
+			throw std::runtime_error("Id " + id + " does not exists");
+
+		return obj;
+	}
+
+	static void walkXML(const SceneLoader& loader, const tinyxml2::XMLDocument& xml,
+						const std::string& fileDirectory, SceneHandler& handler)
+	{
+		const auto rootScene = getRootScene(xml);
+
+		Scene scene;
+		parseVersion(rootScene, scene);
+
+		const bool convertFromCamelCase = !loader.mDisableLowerCaseConversion && (scene.mVersionMajor == 0);
+		const ParseContext ctx(loader.mArguments, loader, fileDirectory, convertFromCamelCase);
+
+		handler.onObjectBegin(OT_SCENE, "", "", "");
+		walkObject(ctx, handler, rootScene, PF_C_SCENE);
+		handler.onObjectEnd(OT_SCENE);
+	}
+
+	static Scene loadFromFile(const SceneLoader& loader, const char* path, LoadCache* cache)
+	{
+		auto xml = std::make_shared<tinyxml2::XMLDocument>();
+		xml->LoadFile(path);
+
+		return loadFromXML(loader, xml, extractDirectoryOfPath(path), cache);
+	}
+
+private:
+	static std::shared_ptr<LazyPropertyScope> createLazyScope(const SceneLoader& loader, const std::shared_ptr<const tinyxml2::XMLDocument>& xml,
+															  const std::string& fileDirectory)
+	{
+		auto lazy = std::make_shared<LazyPropertyScope>();
+		lazy->Documents.push_back(xml);
+		lazy->Loader		= loader;
+		lazy->FileDirectory = fileDirectory;
+		return lazy;
+	}
+
+	static const tinyxml2::XMLElement* getRootScene(const tinyxml2::XMLDocument& xml)
+	{
+		if (xml.Error())
+			throw std::runtime_error(xml.ErrorStr());
+
+		const auto rootScene = xml.RootElement();
+		if (!rootScene)
+			throw std::runtime_error("Root element is null");
+
+		if (strcmp(rootScene->Name(), "scene") != 0)
+			throw std::runtime_error("Expected root element to be 'scene'");
+
+		return rootScene;
+	}
+
+	static void buildIndices(Scene& scene)
+	{
+		std::unordered_set<const Object*> visited;
+		const std::function<void(Object*)> visit = [&](Object* obj) {
+			if (!visited.insert(obj).second)
+				return;
+
+			scene.mTypeIndex[obj->type()].push_back(obj);
+			scene.mPluginTypeIndex[obj->type()][obj->pluginType()].push_back(obj);
+			for (const auto& prop : obj->properties())
+				scene.mPropertyIndex[prop.first].push_back(obj);
+
+			for (const auto& child : obj->children())
+				visit(child.object);
+		};
+
+		for (const auto& child : scene.anonymousChildren())
+			visit(child.get());
+	}
+
+	// Done after parsing, as objects might get replaced by deduplication beforehand
+	static void linkParents(Scene& scene)
+	{
+		// Top-level objects have no parent, even if referenced somewhere else
+		std::unordered_set<const Object*> visited;
+		for (const auto& child : scene.anonymousChildren())
+			visited.insert(child.get());
+
+		const std::function<void(Object*)> link = [&](Object* obj) {
+			for (const auto& child : obj->children()) {
+				if (!visited.insert(child.object).second)
+					continue;
+				child.object->mParent = obj;
+				link(child.object);
+			}
+		};
+
+		for (const auto& child : scene.anonymousChildren())
+			link(child.get());
+	}
+
+	static void parseVersion(const tinyxml2::XMLElement* rootScene, Scene& scene)
+	{
+		try {
+			_parseVersion(rootScene->Attribute("version"), scene.mVersionMajor, scene.mVersionMinor, scene.mVersionPatch);
+		} catch (...) {
+			throw std::runtime_error("Invalid version element");
+		}
+	}
 };
 
-Transform parseInnerMatrix(const ParseContext& ctx, const tinyxml2::XMLElement* element)
+Scene SceneLoader::loadFromFile(const char* path) const
 {
-	Transform inner = Transform::fromIdentity();
-	for (auto childElement = element->FirstChildElement();
-		 childElement;
-		 childElement = childElement->NextSiblingElement()) {
+	return InternalSceneLoader::loadFromFile(*this, path, nullptr);
+}
+
+std::shared_ptr<Object> SceneLoader::loadObjectById(const char* path, const char* id) const
+{
+	tinyxml2::XMLDocument xml;
+	xml.LoadFile(path);
+
+	return InternalSceneLoader::loadObjectFromXML(*this, xml, extractDirectoryOfPath(path), id);
+}
+
+Scene SceneLoader::loadFromString(const char* str) const
+{
+	auto xml = std::make_shared<tinyxml2::XMLDocument>();
+	xml->Parse(str);
+	return InternalSceneLoader::loadFromXML(*this, xml, std::string(), nullptr);
+}
+
+Scene SceneLoader::loadFromString(const char* str, size_t max_len) const
+{
+	auto xml = std::make_shared<tinyxml2::XMLDocument>();
+	xml->Parse(str, max_len);
+	return InternalSceneLoader::loadFromXML(*this, xml, std::string(), nullptr);
+}
+
+std::vector<BatchLoadResult> SceneLoader::loadBatch(const std::vector<std::string>& paths, size_t threadCount) const
+{
+	std::vector<BatchLoadResult> results(paths.size());
+	LoadCache cache;
+
+	parallelFor(paths.size(), threadCount, [&](size_t i) {
+		BatchLoadResult& result = results[i];
+		result.path				= paths[i];
+		try {
+			result.scene = std::make_shared<Scene>(InternalSceneLoader::loadFromFile(*this, paths[i].c_str(), &cache));
+		} catch (const std::exception& e) {
+			result.error = e.what();
+		}
+	});
+
+	return results;
+}
+
+void SceneLoader::parseFromFile(const char* path, SceneHandler& handler) const
+{
+	tinyxml2::XMLDocument xml;
+	xml.LoadFile(path);
+	InternalSceneLoader::walkXML(*this, xml, extractDirectoryOfPath(path), handler);
+}
+
+void SceneLoader::parseFromString(const char* str, SceneHandler& handler) const
+{
+	tinyxml2::XMLDocument xml;
+	xml.Parse(str);
+	InternalSceneLoader::walkXML(*this, xml, std::string(), handler);
+}
+
+/*Scene SceneLoader::loadFromStream(std::istream& stream)
+{
+	// TODO
+	return Scene();
+}*/
+
+const PluginBinding* SceneLoader::pluginBinding(ObjectType type, const std::string& pluginType) const
+{
+	const auto& bindings = mBindings[type];
+	if (bindings.empty())
+		return nullptr;
+
+	const auto it = bindings.find(pluginType);
+	return it == bindings.end() ? nullptr : &it->second;
+}
+
+Scene SceneLoader::loadFromMemory(const uint8_t* data, size_t size) const
+{
+	auto xml = std::make_shared<tinyxml2::XMLDocument>();
+	xml->Parse(reinterpret_cast<const char*>(data), size);
+	return InternalSceneLoader::loadFromXML(*this, xml, std::string(), nullptr);
+}
+
+// ------------- Scene
+static inline Property transformProperty(const Object& obj)
+{
+	auto prop = obj.property("to_world");
+	if (!prop.isValid())
+		prop = obj.property("toWorld");
+	return prop;
+}
+
+// Local transforms of objects with a singular transform (or parent transform) are the identity.
+// Animated transforms are placed at their first keyframe
+static void flattenObject(const Object& obj, const Transform& parentWorld, const Transform& parentLocal, bool parentInvertible, bool parentAnimated,
+						  const Object* instance, bool inGroup, TransformTable& table)
+{
+	if (obj.type() != OT_SHAPE && obj.type() != OT_SENSOR)
+		return;
+
+	// Shapegroups are only visible via instances
+	if (obj.pluginType() == "shapegroup") {
+		if (!inGroup)
+			return;
+		for (const auto& child : obj.anonymousChildren())
+			flattenObject(*child, parentWorld, parentLocal, parentInvertible, parentAnimated, instance, false, table);
+		return;
+	}
+
+	const auto prop = transformProperty(obj);
+	Transform world = parentWorld;
+	Transform local = parentLocal;
+	bool invertible = parentInvertible;
+	bool animated	= parentAnimated;
+	if (prop.type() == PT_TRANSFORM || prop.type() == PT_ANIMATION) {
+		const Transform identity = Transform::fromIdentity();
+
+		bool ok;
+		Transform transform;
+		Transform inverse;
+		if (prop.type() == PT_TRANSFORM) {
+			transform = prop.getTransform();
+			inverse	  = prop.getTransformInverse(identity, &ok);
+		} else {
+			// Explicit default, as a reference to the default argument would dangle
+			const Animation empty;
+			const AnimationEvaluator evaluator(prop.getAnimation(empty));
+			transform = evaluator.keyFrameCount() > 0 ? evaluator.evaluate(evaluator.keyFrameTimes()[0]) : identity;
+			inverse	  = transform.inverse(&ok);
+			animated  = true;
+		}
+
+		world	   = parentWorld * transform;
+		invertible = invertible && ok;
+		local	   = invertible ? inverse * parentLocal : identity;
+	}
+
+	if (obj.pluginType() == "instance") {
+		for (const auto& child : obj.anonymousChildren())
+			flattenObject(*child, world, local, invertible, animated, &obj, true, table);
+		for (const auto& child : obj.namedChildren())
+			flattenObject(*child.second, world, local, invertible, animated, &obj, true, table);
+		return;
+	}
+
+	table.objects.push_back(&obj);
+	table.instances.push_back(instance);
+	table.types.push_back(obj.type());
+	table.toWorld.push_back(world);
+	table.toLocal.push_back(local);
+	table.invertible.push_back(invertible ? 1 : 0);
+	table.animated.push_back(animated ? 1 : 0);
+
+	// Sensors attached to a shape (e.g., an irradiancemeter) are placed relative to it
+	if (obj.type() == OT_SHAPE) {
+		for (const auto& child : obj.children()) {
+			if (child.object->type() == OT_SENSOR)
+				flattenObject(*child.object, world, local, invertible, animated, instance, false, table);
+		}
+	}
+}
+
+static void appendTable(TransformTable& dst, const TransformTable& src)
+{
+	dst.objects.insert(dst.objects.end(), src.objects.begin(), src.objects.end());
+	dst.instances.insert(dst.instances.end(), src.instances.begin(), src.instances.end());
+	dst.types.insert(dst.types.end(), src.types.begin(), src.types.end());
+	dst.toWorld.insert(dst.toWorld.end(), src.toWorld.begin(), src.toWorld.end());
+	dst.toLocal.insert(dst.toLocal.end(), src.toLocal.begin(), src.toLocal.end());
+	dst.invertible.insert(dst.invertible.end(), src.invertible.begin(), src.invertible.end());
+	dst.animated.insert(dst.animated.end(), src.animated.begin(), src.animated.end());
+}
+
+TransformTable Scene::flattenTransforms(size_t threadCount) const
+{
+	const auto& children	 = anonymousChildren();
+	const Transform identity = Transform::fromIdentity();
+
+	if (threadCount == 0)
+		threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+	TransformTable table;
+	if (threadCount == 1 || children.size() < 2) {
+		for (const auto& child : children)
+			flattenObject(*child, identity, identity, true, false, nullptr, false, table);
+		return table;
+	}
+
+	// Each thread gets a contiguous range of top-level objects and its own table to keep the document order
+	const size_t ranges = std::min(threadCount, children.size());
+	std::vector<TransformTable> tables(ranges);
+	parallelFor(ranges, threadCount, [&](size_t r) {
+		const size_t end = (r + 1) * children.size() / ranges;
+		for (size_t i = r * children.size() / ranges; i < end; ++i)
+			flattenObject(*children[i], identity, identity, true, false, nullptr, false, tables[r]);
+	});
+
+	size_t rows = 0;
+	for (const auto& t : tables)
+		rows += t.size();
+
+	table.objects.reserve(rows);
+	table.instances.reserve(rows);
+	table.types.reserve(rows);
+	table.toWorld.reserve(rows);
+	table.toLocal.reserve(rows);
+	table.invertible.reserve(rows);
+	table.animated.reserve(rows);
+	for (const auto& t : tables)
+		appendTable(table, t);
+
+	return table;
+}
+
+class SceneCompiler {
+public:
+	explicit SceneCompiler(CompiledScene& compiled)
+		: mCompiled(compiled)
+	{
+	}
+
+	// Assigns rows in depth-first order. Shared objects keep their first row
+	CompiledObjectRef registerObject(const Object& obj)
+	{
+		const auto it = mRows.find(&obj);
+		if (it != mRows.end())
+			return it->second;
+
+		auto& table					= mCompiled.tables[obj.type()];
+		const CompiledObjectRef ref = { obj.type(), static_cast<uint32_t>(table.objects.size()), -1 };
+		mRows[&obj]					= ref;
+		table.objects.push_back(&obj);
+		table.pluginTypes.push_back(intern(mPluginTypes, mCompiled.pluginTypes, obj.pluginType()));
+
+		for (const auto& child : obj.anonymousChildren())
+			registerObject(*child);
+		for (const auto& child : sortedNamedChildren(obj))
+			registerObject(*child.second);
+		return ref;
+	}
+
+	void buildColumns(Number minKeyUsage)
+	{
+		for (auto& table : mCompiled.tables) {
+			const size_t rows = table.objects.size();
+
+			// Count first, such that rare keys do not get a column of the size of the whole table
+			std::map<std::pair<std::string, PropertyType>, size_t> usage;
+			for (const Object* obj : table.objects) {
+				for (const auto& prop : obj->properties())
+					++usage[std::make_pair(prop.first, prop.second.type())];
+			}
+
+			const size_t threshold = std::max<size_t>(1, (size_t)std::ceil(minKeyUsage * Number(rows)));
+			std::map<std::pair<std::string, PropertyType>, size_t> indices;
+			for (const auto& entry : usage) {
+				if (entry.second < threshold)
+					continue;
+
+				indices[entry.first] = table.columns.size();
+				table.columns.push_back(makeColumn(entry.first.first, entry.first.second, rows));
+			}
+
+			if (table.columns.empty())
+				continue;
+
+			for (size_t row = 0; row < rows; ++row) {
+				for (const auto& prop : table.objects[row]->properties()) {
+					const auto it = indices.find(std::make_pair(prop.first, prop.second.type()));
+					if (it != indices.end())
+						setCell(table.columns[it->second], row, prop.second);
+				}
+			}
+		}
+	}
+
+	void buildChildren()
+	{
+		for (auto& table : mCompiled.tables) {
+			table.childOffsets.reserve(table.objects.size() + 1);
+			for (const Object* obj : table.objects) {
+				table.childOffsets.push_back(static_cast<uint32_t>(table.children.size()));
+				for (const auto& child : obj->anonymousChildren())
+					table.children.push_back(mRows.at(child.get()));
+
+				for (const auto& child : sortedNamedChildren(*obj)) {
+					CompiledObjectRef ref = mRows.at(child.second);
+					ref.slot			  = static_cast<int32_t>(intern(mSlots, mCompiled.slots, child.first));
+					table.children.push_back(ref);
+				}
+			}
+			table.childOffsets.push_back(static_cast<uint32_t>(table.children.size()));
+		}
+	}
+
+private:
+	static CompiledColumn makeColumn(const std::string& key, PropertyType type, size_t rows)
+	{
+		CompiledColumn column;
+		column.key	= key;
+		column.type = type;
+		column.present.resize(rows, 0);
+		switch (type) {
+		case PT_NUMBER:
+			column.numbers.resize(rows, Number(0));
+			break;
+		case PT_INTEGER:
+			column.integers.resize(rows, 0);
+			break;
+		case PT_BOOL:
+			column.bools.resize(rows, 0);
+			break;
+		case PT_VECTOR:
+			column.vectors.resize(rows, Vector(0, 0, 0));
+			break;
+		case PT_COLOR:
+			column.colors.resize(rows, Color(0, 0, 0));
+			break;
+		case PT_TRANSFORM:
+			column.transforms.resize(rows, Transform::fromIdentity());
+			break;
+		default:
+			column.values.resize(rows, nullptr);
+			break;
+		}
+		return column;
+	}
+
+	static void setCell(CompiledColumn& column, size_t row, const Property& prop)
+	{
+		column.present[row] = 1;
+		switch (column.type) {
+		case PT_NUMBER:
+			column.numbers[row] = prop.getNumber();
+			break;
+		case PT_INTEGER:
+			column.integers[row] = prop.getInteger();
+			break;
+		case PT_BOOL:
+			column.bools[row] = prop.getBool() ? 1 : 0;
+			break;
+		case PT_VECTOR:
+			column.vectors[row] = prop.getVector();
+			break;
+		case PT_COLOR:
+			column.colors[row] = prop.getColor();
+			break;
+		case PT_TRANSFORM:
+			column.transforms[row] = prop.getTransform();
+			break;
+		default:
+			column.values[row] = &prop;
+			break;
+		}
+	}
+
+	// Named children are stored unordered, sorting keeps the compiled layout deterministic
+	static std::vector<std::pair<std::string, const Object*>> sortedNamedChildren(const Object& obj)
+	{
+		std::vector<std::pair<std::string, const Object*>> named;
+		named.reserve(obj.namedChildren().size());
+		for (const auto& child : obj.namedChildren())
+			named.emplace_back(child.first, child.second.get());
+		std::sort(named.begin(), named.end());
+		return named;
+	}
+
+	static uint32_t intern(std::unordered_map<std::string, uint32_t>& map, std::vector<std::string>& list, const std::string& str)
+	{
+		const auto it = map.find(str);
+		if (it != map.end())
+			return it->second;
+
+		const uint32_t id = static_cast<uint32_t>(list.size());
+		map[str]		  = id;
+		list.push_back(str);
+		return id;
+	}
+
+	CompiledScene& mCompiled;
+	std::unordered_map<const Object*, CompiledObjectRef> mRows;
+	std::unordered_map<std::string, uint32_t> mPluginTypes;
+	std::unordered_map<std::string, uint32_t> mSlots;
+};
+
+std::shared_ptr<Object> Scene::findByID(const std::string& id) const
+{
+	const auto it = mIDs.find(id);
+	return it == mIDs.end() ? nullptr : it->second;
+}
+
+const std::vector<Object*>& Scene::referrers(const Object* obj) const
+{
+	static const std::vector<Object*> empty;
+
+	const auto it = mReferrers.find(obj);
+	return it == mReferrers.end() ? empty : it->second;
+}
+
+const std::vector<Object*>& Scene::referrers(const std::string& id) const
+{
+	return referrers(findByID(id).get());
+}
+
+const std::vector<Object*>& Scene::objectsOfType(ObjectType type, const std::string& pluginType) const
+{
+	static const std::vector<Object*> empty;
+
+	const auto& index = mPluginTypeIndex[type];
+	const auto it	  = index.find(pluginType);
+	return it == index.end() ? empty : it->second;
+}
+
+const std::vector<Object*>& Scene::objectsWithProperty(const std::string& key) const
+{
+	static const std::vector<Object*> empty;
+
+	const auto it = mPropertyIndex.find(key);
+	return it == mPropertyIndex.end() ? empty : it->second;
+}
+
+// The scene and all its descendants in document order, objects shared between parents are listed once.
+// Unlike the indices built while loading this covers objects added or replaced afterwards as well
+static std::vector<Object*> collectObjects(const Scene& scene)
+{
+	std::vector<Object*> objects;
+	std::unordered_set<const Object*> visited;
+	scene.visitDepthFirst([&](const ObjectVisit& visit) {
+		if (!visited.insert(visit.object).second)
+			return false;
+
+		// The traversal is const only, the objects themselves are owned mutable by their parents
+		objects.push_back(const_cast<Object*>(visit.object));
+		return true;
+	});
+	return objects;
+}
+
+void Scene::poolValues()
+{
+	if (!mPool)
+		mPool = std::make_shared<ValuePool>();
+	mPool->beginPass();
+	mPoolReport = PoolReport();
+
+	for (Object* obj : collectObjects(*this)) {
+		for (const auto& prop : obj->properties()) {
+			Property pooled = prop.second;
+			if (mPool->intern(pooled, mPoolReport))
+				obj->setProperty(prop.first, pooled);
+		}
+	}
+}
+
+void Scene::enableJournal()
+{
+	if (!mJournal)
+		attachJournal(std::make_shared<ChangeJournal>());
+}
+
+void Scene::disableJournal()
+{
+	attachJournal(nullptr);
+}
+
+CompiledScene Scene::compile(Number minKeyUsage) const
+{
+	CompiledScene compiled;
+	SceneCompiler compiler(compiled);
+
+	for (const auto& child : anonymousChildren())
+		compiled.roots.push_back(compiler.registerObject(*child));
+
+	compiler.buildColumns(minKeyUsage);
+	compiler.buildChildren();
+	return compiled;
+}
+
+// ------------- Diff
+static const char* diffTypeName(ObjectType type)
+{
+	for (int i = 0; _parseElements[i].Name; ++i) {
+		if (_parseElements[i].Type == type)
+			return _parseElements[i].Name;
+	}
+	return "scene";
+}
+
+static inline std::string diffJoinPath(const std::string& parent, const std::string& segment)
+{
+	return parent.empty() ? segment : parent + "/" + segment;
+}
+
+class SceneDiffer {
+public:
+	inline explicit SceneDiffer(SceneDiff& result)
+		: mResult(result)
+	{
+	}
+
+	void diffObject(const Object& before, const Object& after, const std::string& path)
+	{
+		if (&before == &after || before.hash() == after.hash())
+			return;
+
+		if (before.type() != after.type() || before.pluginType() != after.pluginType()) {
+			mResult.objects.push_back(ObjectDiff{ DK_REMOVED, path, &before, nullptr });
+			mResult.objects.push_back(ObjectDiff{ DK_ADDED, path, nullptr, &after });
+			return;
+		}
+
+		diffProperties(before, after, path);
+		diffAnonymousChildren(before, after, path);
+		diffNamedChildren(before, after, path);
+	}
+
+private:
+	void diffProperties(const Object& before, const Object& after, const std::string& path)
+	{
+		const size_t start = mResult.properties.size();
+		for (const auto& prop : before.properties()) {
+			const auto it = after.properties().find(prop.first);
+			if (it == after.properties().end())
+				mResult.properties.push_back(PropertyDiff{ DK_REMOVED, path, prop.first, prop.second, Property() });
+			else if (it->second != prop.second)
+				mResult.properties.push_back(PropertyDiff{ DK_MODIFIED, path, prop.first, prop.second, it->second });
+		}
 
-		for (int i = 0; _transformParseElements[i].Name; ++i) {
-			if (strcmp(childElement->Name(), _transformParseElements[i].Name) == 0) {
-				inner = _transformParseElements[i].Callback(ctx, childElement) * inner;
-				break;
-			}
+		for (const auto& prop : after.properties()) {
+			if (!before.properties().count(prop.first))
+				mResult.properties.push_back(PropertyDiff{ DK_ADDED, path, prop.first, Property(), prop.second });
 		}
+
+		if (mResult.properties.size() != start)
+			mResult.objects.push_back(ObjectDiff{ DK_MODIFIED, path, &before, &after });
 	}
 
-	return inner;
-}
+	static inline std::string anonymousSegment(const Object& child, size_t index)
+	{
+		if (child.hasID())
+			return std::string(diffTypeName(child.type())) + "#" + child.id();
+		else
+			return std::string(diffTypeName(child.type())) + "[" + std::to_string(index) + "]";
+	}
 
-static Property parseTransform(const ParseContext& ctx, const tinyxml2::XMLElement* element)
-{
-	const auto transform = parseInnerMatrix(ctx, element);
-	return Property::fromTransform(transform);
-}
+	static std::vector<std::string> anonymousSegments(const Object& obj)
+	{
+		std::vector<std::string> segments;
+		segments.reserve(obj.anonymousChildren().size());
 
-static Property parseAnimation(const ParseContext& ctx, const tinyxml2::XMLElement* element)
-{
-	Animation anim;
-	for (auto childElement = element->FirstChildElement();
-		 childElement;
-		 childElement = childElement->NextSiblingElement()) {
-		if (strcmp(childElement->Name(), "transform") != 0)
-			throw std::runtime_error("Animation entries are only of type transform");
+		std::unordered_map<int, size_t> counters;
+		for (const auto& child : obj.anonymousChildren())
+			segments.push_back(anonymousSegment(*child, child->hasID() ? 0 : counters[child->type()]++));
+		return segments;
+	}
 
-		Number time;
-		if (!unpackNumber(childElement->Attribute("time"), ctx.Arguments, &time))
-			throw std::runtime_error("Animation entry missing time attribute");
+	void diffAnonymousChildren(const Object& before, const Object& after, const std::string& path)
+	{
+		const auto& a = before.anonymousChildren();
+		const auto& b = after.anonymousChildren();
+
+		// Common case: Same layout, only the content of some children changed.
+		// Comparing the cached hashes is cheap, so only build segments if something is off
+		bool aligned = a.size() == b.size();
+		for (size_t i = 0; aligned && i < a.size(); ++i)
+			aligned = a[i]->type() == b[i]->type() && a[i]->id() == b[i]->id();
+
+		if (aligned) {
+			std::unordered_map<int, size_t> counters;
+			for (size_t i = 0; i < a.size(); ++i) {
+				const size_t index = a[i]->hasID() ? 0 : counters[a[i]->type()]++;
+				if (a[i] == b[i] || a[i]->hash() == b[i]->hash())
+					continue;
+
+				diffObject(*a[i], *b[i], diffJoinPath(path, anonymousSegment(*a[i], index)));
+			}
+			return;
+		}
 
-		anim.addKeyFrame(time, parseInnerMatrix(ctx, childElement));
-	}
+		const auto segmentsA = anonymousSegments(before);
+		const auto segmentsB = anonymousSegments(after);
+
+		// Unchanged children are paired by hash first, such that a single insertion does not shift all later siblings.
+		// Equal children are paired in document order
+		std::unordered_map<uint64_t, std::vector<size_t>> unchanged;
+		unchanged.reserve(b.size());
+		for (size_t i = b.size(); i-- > 0;)
+			unchanged[b[i]->hash()].push_back(i);
+
+		std::vector<bool> matchedA(a.size(), false);
+		std::vector<bool> matchedB(b.size(), false);
+		for (size_t i = 0; i < a.size(); ++i) {
+			const auto it = unchanged.find(a[i]->hash());
+			if (it == unchanged.end() || it->second.empty())
+				continue;
 
-	return Property::fromAnimation(anim);
-}
+			matchedA[i]					= true;
+			matchedB[it->second.back()] = true;
+			it->second.pop_back();
+		}
 
-using PropertyParseCallback = Property (*)(const ParseContext&, const tinyxml2::XMLElement*);
+		// The remaining children are paired by id or by their index among the remaining children of the same type
+		std::unordered_map<std::string, size_t> lookup;
+		std::unordered_map<int, size_t> counters;
+		for (size_t i = 0; i < b.size(); ++i) {
+			if (!matchedB[i])
+				lookup.emplace(anonymousSegment(*b[i], b[i]->hasID() ? 0 : counters[b[i]->type()]++), i);
+		}
 
-static const struct {
-	const char* Name;
-	PropertyParseCallback Callback;
-} _propertyParseElement[] = {
-	{ "integer", parseInteger },
-	{ "float", parseFloat },
-	{ "vector", parseVector },
-	{ "point", parseVector },
-	{ "boolean", parseBool },
-	{ "string", parseString },
-	{ "rgb", parseRGB },
-	{ "spectrum", parseSpectrum },
-	{ "blackbody", parseBlackbody },
-	{ "transform", parseTransform },
-	{ "animation", parseAnimation },
-	{ nullptr, nullptr }
-};
+		counters.clear();
+		for (size_t i = 0; i < a.size(); ++i) {
+			if (matchedA[i])
+				continue;
 
-bool parseParameter(Object* obj, const ParseContext& ctx, const tinyxml2::XMLElement* element)
-{
-	auto name = element->Attribute("name");
-	if (!name)
-		return false;
+			const auto it = lookup.find(anonymousSegment(*a[i], a[i]->hasID() ? 0 : counters[a[i]->type()]++));
+			if (it == lookup.end()) {
+				mResult.objects.push_back(ObjectDiff{ DK_REMOVED, diffJoinPath(path, segmentsA[i]), a[i].get(), nullptr });
+			} else {
+				matchedB[it->second] = true;
+				diffObject(*a[i], *b[it->second], diffJoinPath(path, segmentsA[i]));
+			}
+		}
 
-	const std::string lcname = convertCC(name, ctx.ConvertCamelCase);
-	for (int i = 0; _propertyParseElement[i].Name; ++i) {
-		if (strcmp(element->Name(), _propertyParseElement[i].Name) == 0) {
-			auto prop = _propertyParseElement[i].Callback(ctx, element);
-			if (prop.isValid())
-				obj->setProperty(lcname, prop);
-			return true;
+		for (size_t i = 0; i < b.size(); ++i) {
+			if (!matchedB[i])
+				mResult.objects.push_back(ObjectDiff{ DK_ADDED, diffJoinPath(path, segmentsB[i]), nullptr, b[i].get() });
 		}
 	}
 
-	return false;
-}
+	void diffNamedChildren(const Object& before, const Object& after, const std::string& path)
+	{
+		for (const auto& child : before.namedChildren()) {
+			const auto it = after.namedChildren().find(child.first);
+			if (it == after.namedChildren().end())
+				mResult.objects.push_back(ObjectDiff{ DK_REMOVED, diffJoinPath(path, child.first), child.second.get(), nullptr });
+			else if (child.second->hash() != it->second->hash())
+				diffObject(*child.second, *it->second, diffJoinPath(path, child.first));
+		}
 
-static void handleAlias(IDContainer& idcontainer, const tinyxml2::XMLElement* element)
-{
-	auto id = element->Attribute("id");
-	auto as = element->Attribute("as");
+		for (const auto& child : after.namedChildren()) {
+			if (!before.namedChildren().count(child.first))
+				mResult.objects.push_back(ObjectDiff{ DK_ADDED, diffJoinPath(path, child.first), nullptr, child.second.get() });
+		}
+	}
 
-	if (!id || !as)
-		throw std::runtime_error("Invalid alias element");
+	SceneDiff& mResult;
+};
 
-	if (!idcontainer.hasID(id))
-		throw std::runtime_error("Unknown id " + std::string(id));
+SceneDiff diff(const Scene& before, const Scene& after)
+{
+	SceneDiff result;
+	SceneDiffer(result).diffObject(before, after, std::string());
+	return result;
+}
 
-	if (idcontainer.hasID(as))
-		throw std::runtime_error("Id " + std::string(as) + " already existent");
+// ------------- Spectrum Resampling
+SpectrumResampler::SpectrumResampler(Number start, Number end, Number step)
+	: mStart(start)
+	, mStep(step)
+	, mSampleCount(0)
+	, mCacheSize(0)
+{
+	if (!(step > Number(0)) || end < start)
+		throw std::runtime_error("Invalid spectral grid");
 
-	idcontainer.makeAlias(id, as);
+	mSampleCount = (size_t)std::floor((end - start) / step + Number(1e-4)) + 1;
 }
 
-static void handleDefault(ArgumentContainer& cnt, const tinyxml2::XMLElement* element)
+SpectrumResampler::CacheEntry* SpectrumResampler::findOrInsert(const Spectrum& spectrum, bool* inserted)
 {
-	auto name  = element->Attribute("name");
-	auto value = element->Attribute("value");
-
-	if (!name || !value)
-		throw std::runtime_error("Invalid default element");
+	auto& bucket = mCache[hashSpectrum(spectrum)];
+	for (const auto& entry : bucket) {
+		if (entry->spectrum == spectrum) {
+			*inserted = false;
+			return entry.get();
+		}
+	}
 
-	if (!cnt.count(name))
-		cnt[name] = value;
+	bucket.emplace_back(new CacheEntry{ spectrum, std::vector<Number>() });
+	++mCacheSize;
+	*inserted = true;
+	return bucket.back().get();
 }
 
-static void handleReference(Object* obj, const ParseContext& ctx, const IDContainer& ids, const tinyxml2::XMLElement* element, int flags)
+// Grid points between two samples are processed in one branchless loop
+void SpectrumResampler::sample(CacheEntry& entry) const
 {
-	auto id	  = element->Attribute("id");
-	auto name = element->Attribute("name");
+	const Spectrum& spectrum = entry.spectrum;
+	auto& samples			 = entry.samples;
+	samples.assign(mSampleCount, Number(0));
 
-	if (!id)
-		throw std::runtime_error("Invalid ref element");
+	if (spectrum.isUniform()) {
+		std::fill(samples.begin(), samples.end(), spectrum.uniformValue());
+		return;
+	}
 
-	const auto ref_id = unpackValues(id, ctx.Arguments);
+	const auto& wvls	= spectrum.wavelengths();
+	const auto& weights = spectrum.weights();
+	const size_t count	= std::min(wvls.size(), weights.size());
+	if (count == 0)
+		return;
 
-	if (!ids.hasID(ref_id))
-		throw std::runtime_error("Id " + ref_id + " does not exists");
+	const Number invStep = Number(1) / mStep;
+	const auto gridIndex = [&](Number wavelength, bool up) {
+		const double x = double(wavelength - mStart) * invStep;
+		return (std::ptrdiff_t)(up ? std::ceil(x) : std::floor(x));
+	};
+	const std::ptrdiff_t last = (std::ptrdiff_t)mSampleCount - 1;
+
+	for (size_t k = 0; k + 1 < count; ++k) {
+		const Number a = wvls[k];
+		const Number b = wvls[k + 1];
+		if (!(b > a))
+			continue;
 
-	auto ref = ids.get(ref_id);
+		const std::ptrdiff_t begin = std::max<std::ptrdiff_t>(0, gridIndex(a, true));
+		const std::ptrdiff_t end = std::min<std::ptrdiff_t>(last, gridIndex(b, false));
 
-	if (flags & OT_PF(obj->type())) {
-		if (name)
-			obj->addNamedChild(convertCC(name, ctx.ConvertCamelCase), ref);
-		else
-			obj->addAnonymousChild(ref);
-	} else {
-		throw std::runtime_error("Id " + ref_id + " not of allowed type");
+		const Number invWidth = Number(1) / (b - a);
+		const Number base	  = weights[k];
+		const Number slope	  = (weights[k + 1] - base) * invWidth;
+		Number* out			  = samples.data();
+		for (std::ptrdiff_t i = begin; i <= end; ++i)
+			out[i] = base + (mStart + i * mStep - a) * slope;
+	}
+
+	// A single sample only covers grid points at exactly its wavelength
+	if (count == 1) {
+		const std::ptrdiff_t i = gridIndex(wvls[0], false);
+		if (i >= 0 && i <= last && wavelength(i) == wvls[0])
+			samples[i] = weights[0];
 	}
 }
 
-static void parseObject(Object*, const ParseContext&, IDContainer&, const tinyxml2::XMLElement*, int);
-static void handleInclude(Object* obj, const ParseContext& ctx, IDContainer& ids,
-						  const tinyxml2::XMLElement* element)
+const Number* SpectrumResampler::resample(const Spectrum& spectrum)
 {
-	// TODO: Any default statement inside a include is not visible in the parent scope. But should that not be the case?
+	bool inserted;
+	CacheEntry* entry = findOrInsert(spectrum, &inserted);
+	if (inserted)
+		sample(*entry);
+	return entry->samples.data();
+}
 
-	auto filename = element->Attribute("filename");
-	if (!filename)
-		throw std::runtime_error("Invalid include element");
+size_t SpectrumResampler::resample(const Scene& scene, size_t threadCount)
+{
+	std::unordered_set<const CacheEntry*> distinct;
+	std::vector<CacheEntry*> pending;
+	const auto collect = [&](const Object& obj) {
+		for (const auto& prop : obj.properties()) {
+			if (prop.second.type() != PT_SPECTRUM)
+				continue;
 
-	const std::string unpacked_filename = unpackValues(filename, ctx.Arguments);
-	const std::string full_path			= resolvePath(unpacked_filename, ctx.LookupPaths);
+			bool inserted;
+			CacheEntry* entry = findOrInsert(prop.second.getSpectrum(), &inserted);
+			distinct.insert(entry);
+			if (inserted)
+				pending.push_back(entry);
+		}
+	};
 
-	if (full_path.empty())
-		throw std::runtime_error("File " + std::string(unpacked_filename) + " not found");
+	for (const Object* obj : collectObjects(scene))
+		collect(*obj);
 
-	// Load xml
-	tinyxml2::XMLDocument xml;
-	xml.LoadFile(full_path.c_str());
+	parallelFor(pending.size(), threadCount, [&](size_t i) { sample(*pending[i]); });
+	return distinct.size();
+}
 
-	const auto rootScene = xml.RootElement();
-	if (strcmp(rootScene->Name(), "scene") != 0)
-		throw std::runtime_error("Expected root element to be 'scene'");
+void SpectrumResampler::evaluate(const Spectrum& spectrum, const Number* wavelengths, Number* out, size_t count)
+{
+	const Number* samples = resample(spectrum);
+	const Number invStep  = Number(1) / mStep;
+	const Number last	  = Number(mSampleCount - 1);
+
+	for (size_t i = 0; i < count; ++i) {
+		const Number x	   = (wavelengths[i] - mStart) * invStep;
+		const bool inside  = x >= Number(0) && x <= last;
+		const Number xc	   = inside ? x : Number(0);
+		const size_t index = std::min((size_t)xc, mSampleCount > 1 ? mSampleCount - 2 : 0);
+		const size_t next  = std::min(index + 1, mSampleCount - 1);
+		const Number t	   = xc - Number(index);
+		const Number value = samples[index] + t * (samples[next] - samples[index]);
+		out[i]			   = inside ? value : Number(0);
+	}
+}
 
-	// Ignore version
+void SpectrumResampler::clearCache()
+{
+	mCache.clear();
+	mCacheSize = 0;
+}
 
-	// Parse as scene
-	parseObject(obj, ctx, ids, rootScene, PF_C_SCENE);
+// ------------- Color Conversion
+// Multi-lobe fit of the CIE 1931 2 degree observer, see Wyman, Sloan and Shirley,
+// "Simple Analytic Approximations to the CIE XYZ Color Matching Functions", JCGT 2013
+static inline double cieLobe(double lambda, double mean, double sigmaLeft, double sigmaRight)
+{
+	const double t = (lambda - mean) / (lambda < mean ? sigmaLeft : sigmaRight);
+	return std::exp(-0.5 * t * t);
 }
 
-static const struct {
-	const char* Name;
-	ObjectType Type;
-	int Flags;
-} _parseElements[] = {
-	{ "bsdf", OT_BSDF, PF_C_BSDF },
-	{ "emitter", OT_EMITTER, PF_C_EMITTER },
-	{ "film", OT_FILM, PF_C_FILM },
-	{ "integrator", OT_INTEGRATOR, PF_C_INTEGRATOR },
-	{ "medium", OT_MEDIUM, PF_C_MEDIUM },
-	{ "phase", OT_PHASE, PF_C_PHASE },
-	{ "sampler", OT_SAMPLER, PF_C_SAMPLER },
-	{ "sensor", OT_SENSOR, PF_C_SENSOR },
-	{ "shape", OT_SHAPE, PF_C_SHAPE },
-	{ "subsurface", OT_SUBSURFACE, PF_C_SUBSURFACE },
-	{ "rfilter", OT_RFILTER, PF_C_RFILTER },
-	{ "texture", OT_TEXTURE, PF_C_TEXTURE },
-	{ "volume", OT_VOLUME, PF_C_VOLUME },
-	{ nullptr, ObjectType(0), 0 }
+static inline Color transformColor(const double* m, const Color& c)
+{
+	return Color(Number(m[0] * c.r + m[1] * c.g + m[2] * c.b),
+				 Number(m[3] * c.r + m[4] * c.g + m[5] * c.b),
+				 Number(m[6] * c.r + m[7] * c.g + m[8] * c.b));
+}
+
+static const double SRGB_TO_XYZ[] = {
+	0.4124564, 0.3575761, 0.1804375,
+	0.2126729, 0.7151522, 0.0721750,
+	0.0193339, 0.1191920, 0.9503041
 };
 
-static void parseObject(Object* obj, const ParseContext& ctx, IDContainer& ids, const tinyxml2::XMLElement* element, int flags)
-{
-	// Copy container to make sure recursive elements do not overwrite it
-	ArgumentContainer cnt = ctx.Arguments;
-	ParseContext nextCtx{ cnt, ctx.LookupPaths, ctx.ConvertCamelCase };
+static const double XYZ_TO_SRGB[] = {
+	3.2404542, -1.5371385, -0.4985314,
+	-0.9692660, 1.8760108, 0.0415560,
+	0.0556434, -0.2040259, 1.0572252
+};
 
-	for (auto childElement = element->FirstChildElement();
-		 childElement;
-		 childElement = childElement->NextSiblingElement()) {
+// Cone response used for the chromatic adaptation of spectral values
+static const double BRADFORD[] = {
+	0.8951, 0.2664, -0.1614,
+	-0.7502, 1.7135, 0.0367,
+	0.0389, -0.0685, 1.0296
+};
 
-		if ((flags & PF_PARAMETER) && parseParameter(obj, nextCtx, childElement))
-			continue;
+static const double BRADFORD_INV[] = {
+	0.9869929, -0.1470543, 0.1599627,
+	0.4323053, 0.5183603, 0.0492912,
+	-0.0085287, 0.0400428, 0.9684867
+};
 
-		if ((flags & PF_REFERENCE) && strcmp(childElement->Name(), "ref") == 0) {
-			handleReference(obj, ctx, ids, childElement, flags);
-		} else if ((flags & PF_DEFAULT) && strcmp(childElement->Name(), "default") == 0) {
-			handleDefault(cnt, childElement);
-		} else if ((flags & PF_INCLUDE) && strcmp(childElement->Name(), "include") == 0) {
-			handleInclude(obj, nextCtx, ids, childElement);
-		} else if ((flags & PF_ALIAS) && strcmp(childElement->Name(), "alias") == 0) {
-			handleAlias(ids, childElement);
-		} else if ((flags & PF_NULL) && strcmp(childElement->Name(), "null") == 0) {
-			// Handle null
-		} else {
-			std::shared_ptr<Object> child;
+struct CIETable {
+	static constexpr int Start = 360;
+	static constexpr int Count = 471; // 360 - 830 nm
 
-			for (int i = 0; _parseElements[i].Name; ++i) {
-				if ((OT_PF(_parseElements[i].Type) & flags)
-					&& strcmp(childElement->Name(), _parseElements[i].Name) == 0) {
+	std::array<Number, Count> Wavelengths;
+	std::array<double, Count> X, Y, Z; // Scaled such that a constant spectrum of one has Y = 1
+	// Adapts the equal energy white of the integrated spectra to the sRGB white
+	std::array<double, 9> ToD65;
 
-					auto pluginType = childElement->Attribute("type");
-					auto id			= childElement->Attribute("id");
-					child			= std::make_shared<Object>(_parseElements[i].Type, pluginType ? pluginType : "", id ? id : "");
-					parseObject(child.get(), nextCtx, ids, childElement, _parseElements[i].Flags);
-					break;
-				}
-			}
+	CIETable()
+	{
+		double integralY = 0;
+		for (int i = 0; i < Count; ++i) {
+			const double lambda = Start + i;
+			Wavelengths[i]		= Number(lambda);
+			X[i]				= 1.056 * cieLobe(lambda, 599.8, 37.9, 31.0) + 0.362 * cieLobe(lambda, 442.0, 16.0, 26.7) - 0.065 * cieLobe(lambda, 501.1, 20.4, 26.2);
+			Y[i]				= 0.821 * cieLobe(lambda, 568.8, 46.9, 40.5) + 0.286 * cieLobe(lambda, 530.9, 16.3, 31.1);
+			Z[i]				= 1.217 * cieLobe(lambda, 437.0, 11.8, 36.0) + 0.681 * cieLobe(lambda, 459.0, 26.0, 13.8);
+			integralY += Y[i];
+		}
 
-			if (child) {
-				if (child->hasID()) {
-					if (!ids.hasID(child->id())) {
-						ids.registerID(child->id(), child);
-					} else {
-						// TODO: Warning
-					}
-				}
+		double whiteX = 0, whiteZ = 0;
+		for (int i = 0; i < Count; ++i) {
+			X[i] /= integralY;
+			Y[i] /= integralY;
+			Z[i] /= integralY;
+			whiteX += X[i];
+			whiteZ += Z[i];
+		}
 
-				auto name = childElement->Attribute("name");
-				if (name)
-					obj->addNamedChild(convertCC(name, ctx.ConvertCamelCase), child);
-				else
-					obj->addAnonymousChild(child);
-			} else {
-				std::stringstream stream;
-				stream << "Found invalid tag '" << childElement->Name() << "'";
-				throw std::runtime_error(stream.str());
+		// Von Kries scaling in Bradford space, such that a constant spectrum maps to the same color as a uniform one
+		const double source[] = { whiteX, 1, whiteZ };
+		double target[3];
+		for (int r = 0; r < 3; ++r)
+			target[r] = SRGB_TO_XYZ[r * 3] + SRGB_TO_XYZ[r * 3 + 1] + SRGB_TO_XYZ[r * 3 + 2];
+
+		const auto cone = [](int k, const double* xyz) { return BRADFORD[k * 3] * xyz[0] + BRADFORD[k * 3 + 1] * xyz[1] + BRADFORD[k * 3 + 2] * xyz[2]; };
+		double scale[3];
+		for (int k = 0; k < 3; ++k)
+			scale[k] = cone(k, target) / cone(k, source);
+
+		for (int r = 0; r < 3; ++r) {
+			for (int c = 0; c < 3; ++c) {
+				ToD65[r * 3 + c] = 0;
+				for (int k = 0; k < 3; ++k)
+					ToD65[r * 3 + c] += BRADFORD_INV[r * 3 + k] * scale[k] * BRADFORD[k * 3 + c];
 			}
 		}
 	}
-}
 
-class InternalSceneLoader {
-public:
-	static Scene loadFromXML(const SceneLoader& loader, const tinyxml2::XMLDocument& xml)
+	static const CIETable& instance()
 	{
-		if (xml.Error())
-			throw std::runtime_error(xml.ErrorStr());
+		static const CIETable table;
+		return table;
+	}
+};
+constexpr int CIETable::Start;
+constexpr int CIETable::Count;
 
-		const auto rootScene = xml.RootElement();
-		if (!rootScene)
-			throw std::runtime_error("Root element is null");
+static inline Color spectrumToXYZ(const Spectrum& spectrum)
+{
+	const CIETable& cie = CIETable::instance();
 
-		if (strcmp(rootScene->Name(), "scene") != 0)
-			throw std::runtime_error("Expected root element to be 'scene'");
+	std::array<Number, CIETable::Count> samples;
+	spectrum.evaluate(cie.Wavelengths.data(), samples.data(), CIETable::Count);
 
-		Scene scene;
-		IDContainer idcontainer;
+	double x = 0, y = 0, z = 0;
+	for (int i = 0; i < CIETable::Count; ++i) {
+		x += samples[i] * cie.X[i];
+		y += samples[i] * cie.Y[i];
+		z += samples[i] * cie.Z[i];
+	}
+	return transformColor(cie.ToD65.data(), Color(Number(x), Number(y), Number(z)));
+}
 
-		try {
-			_parseVersion(rootScene->Attribute("version"), scene.mVersionMajor, scene.mVersionMinor, scene.mVersionPatch);
-		} catch (...) {
-			throw std::runtime_error("Invalid version element");
+// Temperatures are processed in blocks, such that the inner loop runs over independent temperatures
+static void blackbodiesToXYZ(const Number* temperatures, Color* out, size_t count)
+{
+	constexpr size_t BLOCK = 16;
+	constexpr double C1	   = 1.191042972e20; // 2hc^2 such that the radiance is in W/(m^2 sr nm) for wavelengths in nm
+	constexpr double C2	   = 1.4387769e7;	 // Second radiation constant in nm K
+
+	const CIETable& cie = CIETable::instance();
+	for (size_t start = 0; start < count; start += BLOCK) {
+		const size_t n = std::min(BLOCK, count - start);
+
+		double invT[BLOCK], x[BLOCK], y[BLOCK], z[BLOCK];
+		for (size_t j = 0; j < n; ++j) {
+			invT[j] = temperatures[start + j] > Number(0) ? 1.0 / temperatures[start + j] : 0.0;
+			x[j] = y[j] = z[j] = 0;
 		}
 
-		const bool convertFromCamelCase = !loader.mDisableLowerCaseConversion && (scene.mVersionMajor == 0);
-		parseObject(&scene, ParseContext{ loader.mArguments, loader.mLookupPaths, convertFromCamelCase }, idcontainer, rootScene, PF_C_SCENE);
+		for (int i = 0; i < CIETable::Count; ++i) {
+			const double lambda = CIETable::Start + i;
+			const double a		= C1 / (lambda * lambda * lambda * lambda * lambda);
+			const double b		= C2 / lambda;
+			for (size_t j = 0; j < n; ++j) {
+				const double e		= std::exp(b * invT[j]) - 1.0;
+				const double energy = invT[j] > 0 ? a / e : 0.0;
+				x[j] += energy * cie.X[i];
+				y[j] += energy * cie.Y[i];
+				z[j] += energy * cie.Z[i];
+			}
+		}
 
-		return scene;
+		for (size_t j = 0; j < n; ++j)
+			out[start + j] = transformColor(cie.ToD65.data(), Color(Number(x[j]), Number(y[j]), Number(z[j])));
 	}
-};
+}
 
-Scene SceneLoader::loadFromFile(const char* path)
+ColorConverter::ColorConverter(ColorSpace space)
+	: mColorSpace(space)
+	, mSpectrumCacheSize(0)
 {
-	tinyxml2::XMLDocument xml;
-	xml.LoadFile(path);
+}
 
-	const auto dir = extractDirectoryOfPath(path);
-	if (dir.empty()) {
-		return InternalSceneLoader::loadFromXML(*this, xml);
-	} else {
-		mLookupPaths.insert(mLookupPaths.begin(), dir);
-		const auto res = InternalSceneLoader::loadFromXML(*this, xml);
-		mLookupPaths.erase(mLookupPaths.begin());
-		return res;
+Color ColorConverter::fromXYZ(const Color& xyz) const
+{
+	return mColorSpace == CS_XYZ ? xyz : transformColor(XYZ_TO_SRGB, xyz);
+}
+
+Color ColorConverter::convert(const Color& rgb) const
+{
+	return mColorSpace == CS_XYZ ? transformColor(SRGB_TO_XYZ, rgb) : rgb;
+}
+
+ColorConverter::SpectrumEntry* ColorConverter::findOrInsert(const Spectrum& spectrum, bool* inserted)
+{
+	auto& bucket = mSpectrumCache[hashSpectrum(spectrum)];
+	for (const auto& entry : bucket) {
+		if (entry->spectrum == spectrum) {
+			*inserted = false;
+			return entry.get();
+		}
 	}
+
+	bucket.emplace_back(new SpectrumEntry{ spectrum, Color(0, 0, 0) });
+	++mSpectrumCacheSize;
+	*inserted = true;
+	return bucket.back().get();
 }
 
-Scene SceneLoader::loadFromString(const char* str)
+Color ColorConverter::convert(const Spectrum& spectrum)
 {
-	tinyxml2::XMLDocument xml;
-	xml.Parse(str);
-	return InternalSceneLoader::loadFromXML(*this, xml);
+	if (spectrum.isUniform()) {
+		const Number v = spectrum.uniformValue();
+		return convert(Color(v, v, v));
+	}
+
+	bool inserted;
+	SpectrumEntry* entry = findOrInsert(spectrum, &inserted);
+	if (inserted)
+		entry->xyz = spectrumToXYZ(spectrum);
+	return fromXYZ(entry->xyz);
 }
 
-Scene SceneLoader::loadFromString(const char* str, size_t max_len)
+Color ColorConverter::convert(const Blackbody& blackbody)
 {
-	tinyxml2::XMLDocument xml;
-	xml.Parse(str, max_len);
-	return InternalSceneLoader::loadFromXML(*this, xml);
+	Color color(0, 0, 0);
+	convertBlackbodies(&blackbody.temperature, &color, 1);
+	return Color(color.r * blackbody.scale, color.g * blackbody.scale, color.b * blackbody.scale);
 }
 
-/*Scene SceneLoader::loadFromStream(std::istream& stream)
+void ColorConverter::convertBlackbodies(const Number* temperatures, Color* out, size_t count)
 {
-	// TODO
-	return Scene();
-}*/
+	// Only unknown temperatures are evaluated, all in one batch
+	std::vector<Number> pending;
+	for (size_t i = 0; i < count; ++i) {
+		if (!std::isfinite(temperatures[i]))
+			throw std::runtime_error("Invalid blackbody temperature");
+		if (!mBlackbodyCache.count(temperatures[i]))
+			pending.push_back(temperatures[i]);
+	}
+
+	if (!pending.empty()) {
+		std::sort(pending.begin(), pending.end());
+		pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+
+		std::vector<Color> xyz(pending.size(), Color(0, 0, 0));
+		blackbodiesToXYZ(pending.data(), xyz.data(), pending.size());
+		for (size_t i = 0; i < pending.size(); ++i)
+			mBlackbodyCache.emplace(pending[i], xyz[i]);
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		out[i] = fromXYZ(mBlackbodyCache.at(temperatures[i]));
+}
 
-Scene SceneLoader::loadFromMemory(const uint8_t* data, size_t size)
+Property ColorConverter::convert(const Property& property)
 {
-	tinyxml2::XMLDocument xml;
-	xml.Parse(reinterpret_cast<const char*>(data), size);
-	return InternalSceneLoader::loadFromXML(*this, xml);
+	switch (property.type()) {
+	case PT_COLOR:
+		return Property::fromColor(convert(property.getColor()));
+	case PT_SPECTRUM:
+		return Property::fromColor(convert(property.getSpectrum()));
+	case PT_BLACKBODY:
+		return Property::fromColor(convert(property.getBlackbody()));
+	default:
+		return Property();
+	}
+}
+
+size_t ColorConverter::convert(Scene& scene, size_t threadCount)
+{
+	struct Replacement {
+		Object* Target;
+		const std::string* Name;
+	};
+
+	std::vector<Replacement> replacements;
+	std::vector<Number> temperatures;
+	std::vector<SpectrumEntry*> pending;
+	const auto collect = [&](Object* obj) {
+		for (const auto& prop : obj->properties()) {
+			const Property& value = prop.second;
+			switch (value.type()) {
+			case PT_COLOR:
+				break;
+			case PT_SPECTRUM:
+				if (!value.getSpectrum().isUniform()) {
+					bool inserted;
+					SpectrumEntry* entry = findOrInsert(value.getSpectrum(), &inserted);
+					if (inserted)
+						pending.push_back(entry);
+				}
+				break;
+			case PT_BLACKBODY:
+				temperatures.push_back(value.getBlackbody().temperature);
+				break;
+			default:
+				continue;
+			}
+			replacements.push_back(Replacement{ obj, &prop.first });
+		}
+	};
+
+	for (Object* obj : collectObjects(scene))
+		collect(obj);
+
+	parallelFor(pending.size(), threadCount, [&](size_t i) { pending[i]->xyz = spectrumToXYZ(pending[i]->spectrum); });
+
+	std::vector<Color> unused(temperatures.size(), Color(0, 0, 0));
+	convertBlackbodies(temperatures.data(), unused.data(), temperatures.size());
+
+	// Everything is cached now. Replacing the value does not invalidate the name
+	for (const auto& replacement : replacements)
+		replacement.Target->setProperty(*replacement.Name, convert(replacement.Target->property(*replacement.Name)));
+
+	return replacements.size();
+}
+
+void ColorConverter::clearCache()
+{
+	mSpectrumCache.clear();
+	mBlackbodyCache.clear();
+	mSpectrumCacheSize = 0;
 }
 } // namespace TPM_NAMESPACE
\ No newline at end of file